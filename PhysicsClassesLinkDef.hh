@@ -13,10 +13,13 @@
 #pragma link C++ class Fitters::Data;
 #pragma link C++ class Fitters::Model;
 #pragma link C++ class Fitters::Objective;
+#pragma link C++ class Fitters::FitStats+;
 #pragma link C++ class Fitters::Runner;
 #pragma link C++ class Fitters::Plotter;
 #pragma link C++ class Fitters::Interface+;
 #pragma link C++ class Fitters::CompositeTF1;
+#pragma link C++ namespace Fitters::Voigt;
+#pragma link C++ enum Fitters::Voigt::Mode;
 
 // ANGULAR
 #pragma link C++ namespace Angular;
@@ -0,0 +1,94 @@
+// Per-FCN cost of Fitters::Model evaluation on a 2000-bin spectrum:
+// scalar operator()(x, p) bin by bin vs EvalBatch over the whole grid, with reference and fast Voigts
+#include "TH1.h"
+
+#include "FitData.h"
+#include "FitModel.h"
+#include "FitObjective.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <vector>
+
+int main()
+{
+    const int nbins {2000};
+    const int ngaus {4};
+    const int nvoigt {8};
+    const int nrep {200};
+    // Synthetic flat phase space
+    TH1D hps {"hps", "PS", nbins, -5, 25};
+    for(int b = 1; b <= nbins; b++)
+        hps.SetBinContent(b, 1);
+    Fitters::Model model {ngaus, nvoigt, {hps}, true};
+    // Parameters: peaks spread along the range
+    std::vector<double> pars(model.NPar());
+    for(const auto& comp : model.GetComponents())
+    {
+        double* p {&pars[comp.fOffset]};
+        p[0] = 100;
+        if(comp.fNPar > 1)
+        {
+            p[1] = -3 + 2 * comp.fIdx + (comp.fType == Fitters::Model::FuncType::kVoigt ? 1 : 0);
+            p[2] = 0.3;
+        }
+        if(comp.fNPar > 3)
+            p[3] = 0.5;
+    }
+    std::vector<double> xs(nbins);
+    for(int b = 1; b <= nbins; b++)
+        xs[b - 1] = hps.GetXaxis()->GetBinCenter(b);
+    std::vector<double> ys(nbins);
+
+    // 1-> Scalar
+    auto start {std::chrono::steady_clock::now()};
+    for(int r = 0; r < nrep; r++)
+        for(int i = 0; i < nbins; i++)
+            ys[i] = model(&xs[i], pars.data());
+    auto scalar {std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count() / nrep};
+    double check {ys[nbins / 2]};
+    // 2-> Batch
+    start = std::chrono::steady_clock::now();
+    for(int r = 0; r < nrep; r++)
+        model.EvalBatch(xs.data(), nbins, pars.data(), ys.data());
+    auto batch {std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count() / nrep};
+    // 3-> Batch with fast Voigts
+    std::vector<double> yfast(nbins);
+    model.SetVoigtMode(Fitters::Voigt::Mode::kFast);
+    start = std::chrono::steady_clock::now();
+    for(int r = 0; r < nrep; r++)
+        model.EvalBatch(xs.data(), nbins, pars.data(), yfast.data());
+    auto fast {std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count() / nrep};
+    model.SetVoigtMode(Fitters::Voigt::Mode::kReference);
+    double maxRel {};
+    for(int i = 0; i < nbins; i++)
+        maxRel = std::max(maxRel, std::abs(yfast[i] - ys[i]) / std::abs(ys[i]));
+    // 4-> Full FCN through Objective
+    Fitters::Objective obj {Fitters::Data {hps, -5, 25}, model};
+    start = std::chrono::steady_clock::now();
+    for(int r = 0; r < nrep; r++)
+        obj(pars.data());
+    auto fcn {std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count() / nrep};
+    double chi2 {obj(pars.data())};
+    // 5-> Same FCN on a pool of threads
+    const unsigned int nthreads {4};
+    obj.SetNThreads(nthreads);
+    start = std::chrono::steady_clock::now();
+    for(int r = 0; r < nrep; r++)
+        obj(pars.data());
+    auto fcnMT {std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count() / nrep};
+    double chi2MT {obj(pars.data())};
+
+    std::cout << "---- BenchEvalBatch (" << nbins << " bins, " << model.NPar() << " pars) ----" << '\n';
+    std::cout << "-> Scalar  : " << scalar << " us per FCN" << '\n';
+    std::cout << "-> Batch   : " << batch << " us per FCN" << '\n';
+    std::cout << "-> Speedup : " << scalar / batch << '\n';
+    std::cout << "-> Fast    : " << fast << " us per FCN (max rel. diff to reference " << maxRel << ")" << '\n';
+    std::cout << "-> Chi2 FCN: " << fcn << " us per call" << '\n';
+    std::cout << "-> Chi2 FCN with " << nthreads << " threads: " << fcnMT << " us per call (chi2 " << chi2MT
+              << (chi2MT == chi2 ? ", identical to serial)" : ", DIFFERS from serial!)") << '\n';
+    std::cout << "-> Check   : " << check << " vs " << ys[nbins / 2] << '\n';
+    return 0;
+}
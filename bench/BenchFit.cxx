@@ -0,0 +1,199 @@
+// Cost of the fitting hot path on synthetic spectra: FCN evaluation per bin and full Runner::Fit
+// Cases cover gaussians only, voigts, voigts with penetrability (AddBWL convolution), phase space and the
+// bin evaluation modes of the objective, at several bin counts
+// Usage: BenchFit [output.json] (default BenchFit.json). Results are also printed as a table
+#include "RVersion.h"
+#include "TH1.h"
+#include "TRandom3.h"
+
+#include "FitData.h"
+#include "FitModel.h"
+#include "FitObjective.h"
+#include "FitRunner.h"
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace
+{
+enum class BinMode
+{
+    kCentre,
+    kDivisions,
+    kBinAverage,
+    kIntegral
+};
+
+struct Case
+{
+    std::string fName {};
+    int fNGaus {};
+    int fNVoigt {};
+    bool fPS {};
+    bool fBWL {};
+    BinMode fMode {BinMode::kCentre};
+    std::vector<int> fNBins {};
+};
+
+struct Result
+{
+    std::string fName {};
+    int fNBins {};
+    double fNsPerBin {};
+    double fFitMs {};
+    unsigned int fNCalls {};
+    double fMinimum {};
+    bool fValid {};
+};
+
+std::string ModeName(BinMode mode)
+{
+    switch(mode)
+    {
+    case BinMode::kCentre: return "centre";
+    case BinMode::kDivisions: return "divisions";
+    case BinMode::kBinAverage: return "binaverage";
+    case BinMode::kIntegral: return "integral";
+    }
+    return "";
+}
+
+// True parameters: peaks spread along [-5, 25]
+std::vector<double> TruePars(const Fitters::Model& model)
+{
+    std::vector<double> pars(model.NPar());
+    for(const auto& comp : model.GetComponents())
+    {
+        double* p {&pars[comp.fOffset]};
+        p[0] = (comp.fType == Fitters::Model::FuncType::kPS) ? 0.5 : 200;
+        if(comp.fType == Fitters::Model::FuncType::kCte)
+            p[0] = 2;
+        if(comp.fNPar > 1)
+        {
+            p[1] = -2 + 4 * comp.fIdx + (comp.fType == Fitters::Model::FuncType::kVoigt ? 2 : 0);
+            p[2] = 0.3;
+        }
+        if(comp.fNPar > 3)
+            p[3] = 0.5;
+    }
+    return pars;
+}
+
+Result Run(const Case& c, int nbins)
+{
+    const double xmin {-5};
+    const double xmax {25};
+    // Flat phase space, sampled on the same binning
+    TH1D hps {("hps" + c.fName + std::to_string(nbins)).c_str(), "PS", nbins, xmin, xmax};
+    for(int b = 1; b <= nbins; b++)
+        hps.SetBinContent(b, 10. * nbins / 1000);
+    std::vector<TH1D> ps {};
+    if(c.fPS)
+        ps.push_back(hps);
+    Fitters::Model model {c.fNGaus, c.fNVoigt, ps, true};
+    if(c.fBWL)
+        for(int v = 0; v < c.fNVoigt; v++)
+            model.AddBWL(v, 1, -6, 900, 5);
+    auto truth {TruePars(model)};
+    // Pseudo-data: Poisson around the model, same seed for every build
+    TRandom3 rng {1234};
+    TH1D h {("h" + c.fName + std::to_string(nbins)).c_str(), "Data", nbins, xmin, xmax};
+    model.TriggerConvolution(truth.data(), xmin, xmax);
+    for(int b = 1; b <= nbins; b++)
+    {
+        double x {h.GetBinCenter(b)};
+        h.SetBinContent(b, rng.Poisson(std::max(model(&x, truth.data()), 0.)));
+    }
+    Fitters::Data data {h, xmin, xmax};
+    Fitters::Runner runner {data, model};
+    auto& obj {runner.GetObjective()};
+    obj.SetUseDivisions(c.fMode == BinMode::kDivisions);
+    obj.SetUseBinAverage(c.fMode == BinMode::kBinAverage);
+    obj.SetUseIntegral(c.fMode == BinMode::kIntegral);
+
+    Result res {c.fName + "_" + ModeName(c.fMode), nbins};
+    // 1-> FCN at the true parameters, enough calls for ~10^7 bins (integral mode is much slower)
+    int nrep {std::max(5, (c.fMode == BinMode::kIntegral ? 100000 : 10000000) / nbins)};
+    obj(truth.data());
+    auto start {std::chrono::steady_clock::now()};
+    for(int r = 0; r < nrep; r++)
+        obj(truth.data());
+    auto elapsed {std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count()};
+    res.fNsPerBin = elapsed / nrep / nbins;
+    // 2-> Full fit from displaced amplitudes
+    auto& config {runner.GetFitter().Config()};
+    for(const auto& comp : model.GetComponents())
+    {
+        config.ParSettings(comp.fOffset).SetValue(1.2 * truth[comp.fOffset]);
+        for(unsigned int k = 1; k < comp.fNPar; k++)
+            config.ParSettings(comp.fOffset + k).SetValue(truth[comp.fOffset + k]);
+        if(comp.fType == Fitters::Model::FuncType::kVoigt || comp.fType == Fitters::Model::FuncType::kGauss)
+            config.ParSettings(comp.fOffset + 2).SetLimits(0.05, 2);
+        if(comp.fType == Fitters::Model::FuncType::kVoigt)
+            config.ParSettings(comp.fOffset + 3).SetLimits(0.01, 3);
+    }
+    start = std::chrono::steady_clock::now();
+    res.fValid = runner.Fit(false);
+    res.fFitMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    auto fit {runner.GetFitResult()};
+    res.fNCalls = fit.NCalls();
+    res.fMinimum = fit.MinFcnValue();
+    return res;
+}
+
+void WriteJSON(const std::string& file, const std::vector<Result>& results)
+{
+    std::ofstream out {file};
+    out << std::setprecision(10);
+    out << "{\n  \"root\": \"" << ROOT_RELEASE << "\",\n  \"compiler\": \"" << __VERSION__ << "\",\n";
+    out << "  \"results\": [\n";
+    for(std::size_t i = 0; i < results.size(); i++)
+    {
+        const auto& r {results[i]};
+        out << "    {\"case\": \"" << r.fName << "\", \"nbins\": " << r.fNBins << ", \"ns_per_bin\": " << r.fNsPerBin
+            << ", \"fit_ms\": " << r.fFitMs << ", \"fcn_calls\": " << r.fNCalls << ", \"fcn_min\": " << r.fMinimum
+            << ", \"valid\": " << (r.fValid ? "true" : "false") << "}" << (i + 1 < results.size() ? "," : "") << '\n';
+    }
+    out << "  ]\n}\n";
+}
+} // namespace
+
+int main(int argc, char** argv)
+{
+    std::string file {argc > 1 ? argv[1] : "BenchFit.json"};
+    std::vector<int> nbins {250, 1000, 4000};
+    std::vector<Case> cases {
+        {"gaus", 3, 0, false, false, BinMode::kCentre, nbins},
+        {"gaus", 3, 0, false, false, BinMode::kDivisions, nbins},
+        {"gaus", 3, 0, false, false, BinMode::kBinAverage, nbins},
+        {"gaus", 3, 0, false, false, BinMode::kIntegral, {250}},
+        {"voigt", 1, 3, false, false, BinMode::kCentre, nbins},
+        {"voigt", 1, 3, false, false, BinMode::kBinAverage, nbins},
+        {"bwl", 1, 2, false, true, BinMode::kCentre, nbins},
+        {"bwl", 1, 2, false, true, BinMode::kDivisions, nbins},
+        {"ps", 2, 1, true, false, BinMode::kCentre, nbins},
+        {"ps", 2, 1, true, false, BinMode::kDivisions, nbins},
+    };
+    std::vector<Result> results {};
+    std::cout << "---- BenchFit ----" << '\n';
+    std::cout << std::left << std::setw(18) << "case" << std::setw(8) << "nbins" << std::setw(14) << "ns/bin"
+              << std::setw(14) << "fit [ms]" << std::setw(10) << "FCN calls" << '\n';
+    for(const auto& c : cases)
+    {
+        for(auto n : c.fNBins)
+        {
+            auto& r {results.emplace_back(Run(c, n))};
+            std::cout << std::setw(18) << r.fName << std::setw(8) << r.fNBins << std::setw(14) << r.fNsPerBin
+                      << std::setw(14) << r.fFitMs << std::setw(10) << r.fNCalls << (r.fValid ? "" : " (invalid)")
+                      << '\n';
+        }
+    }
+    WriteJSON(file, results);
+    std::cout << "-> Results written to " << file << '\n';
+    return 0;
+}
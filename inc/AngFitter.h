@@ -2,7 +2,9 @@
 #define AngFitter_h
 
 #include "TCanvas.h"
+#include "TF1.h"
 #include "TFitResult.h"
+#include "TGraphAsymmErrors.h"
 #include "TGraphErrors.h"
 #include "TH1.h"
 
@@ -12,6 +14,8 @@
 #include "FitRunner.h"
 
 #include <functional>
+#include <iostream>
+#include <memory>
 #include <string>
 #include <unordered_map>
 #include <utility>
@@ -32,7 +36,11 @@ private:
     std::vector<Fitters::Data> fData {};          //!
     std::vector<std::vector<TH1D*>> fHistosPS {}; //!
     std::vector<Fitters::Model> fModels {};       //!
+    // Convolutions shared by all interval models: shapes are fixed and identical in most of them
+    std::shared_ptr<Fitters::ConvCache> fConvCache {}; //!
     std::vector<TFitResult> fRes;
+    // Bootstrap of each interval fit, if enabled
+    std::vector<Fitters::Runner::BootstrapStats> fBoot {}; //!
     // Saving the results of the fits
     std::vector<double> fResIvs {};
     std::vector<TGraph*> fResGlobal {};
@@ -40,8 +48,9 @@ private:
     std::vector<std::vector<std::string>> fResNames {};
 
     // Declare integral vectors
-    Counts fIgCounts {};  //!
-    Counts fSumCounts {}; //!
+    Counts fIgCounts {};    //!
+    Counts fIgCountsErr {}; //! from the covariance of each interval fit
+    Counts fSumCounts {};   //!
 
     // Global fit read from file
     std::vector<std::string> fParNames {};
@@ -50,6 +59,10 @@ private:
     // Settings to be sent to fitter
     bool fUseDivisions {true};
     bool fUseIntegral {};
+    // Closed-form bin averages, divisions only for components without one
+    bool fUseBinAverage {};
+    // Baker-Cousins likelihood instead of chi2 (better for low counts)
+    bool fUseLikelihood {};
     // Allow variation of mean of gaussians during interval fit
     bool fAllowFreeMean {};
     double fFreeMeanRange {0.5};                // MeV
@@ -71,6 +84,14 @@ private:
     std::pair<double, double> fManualRange {-1, -1};
     // Specify custom options for certain parameters
     std::unordered_map<std::string, double> fManualPars {};
+    // Bootstrap replicas per interval (0 = disabled), threads and seed
+    unsigned int fNBoot {};
+    unsigned int fNThreadsBoot {1};
+    unsigned long fBootSeed {1};
+    // Intervals fitted concurrently
+    unsigned int fNThreads {1};
+    // Seed each interval from the converged fit of the previous one, amplitudes scaled by the ratio of counts
+    bool fChainIntervals {};
 
 public:
     Fitter() = default;
@@ -80,6 +101,8 @@ public:
     void Configure(const std::string& file);
     void SetUseDivisions(bool use) { fUseDivisions = use; }
     void SetUseIntegral(bool use) { fUseIntegral = use; }
+    void SetUseBinAverage(bool use) { fUseBinAverage = use; }
+    void SetUseLikelihood(bool use) { fUseLikelihood = use; }
     // Free mean settings
     void SetAllowFreeMean(bool allow, const WhichFree& which = {})
     {
@@ -106,12 +129,28 @@ public:
     void SetFixAmpPS(int ips, const std::vector<double>& vals) { fPSFixAmps[ips] = vals; }
     // Specify a manual fitting range different than for the global fit
     void SetManualRange(double min, double max) { fManualRange = {min, max}; };
+    // Fit up to n intervals concurrently. Results and output are the same as with n = 1, in interval order
+    void SetNThreads(unsigned int n) { fNThreads = n; }
+    // Start each interval from the last converged interval before it instead of the global fit
+    // With n threads, intervals are chained within n contiguous blocks
+    void SetChainIntervals(bool chain) { fChainIntervals = chain; }
+    // Bootstrap each interval fit with nreplicas Poisson resamplings of its data (interval i uses seed + i)
+    void SetBootstrap(unsigned int nreplicas, unsigned int nthreads = 1, unsigned long seed = 1)
+    {
+        fNBoot = nreplicas;
+        fNThreadsBoot = nthreads;
+        fBootSeed = seed;
+    }
 
     // Getters
     CountsIv GetIgCountsFor(const std::string& peak) const;
+    CountsIv GetIgCountsErrorsFor(const std::string& peak) const;
     CountsIv GetSumCountsFor(const std::string& peak) const;
     TGraphErrors* GetIgCountsGraph(const std::string& peak) const;
     TGraphErrors* GetSumCountsGraph(const std::string& peak) const;
+    // Counts predicted by the fit of each interval with bootstrap percentile interval at confidence level cl
+    TGraphAsymmErrors* GetBootCountsGraph(const std::string& peak, double cl = 0.6827) const;
+    const std::vector<Fitters::Runner::BootstrapStats>& GetBootstrap() const { return fBoot; }
     const std::vector<std::string>& GetParNames() const { return fParNames; }
     const std::vector<TFitResult>& GetTFitResults() const { return fRes; }
     TFitResult& GetTFitResult(int idx) { return fRes[idx]; }
@@ -120,6 +159,8 @@ public:
     std::vector<std::vector<TH1D*>> GetResHistos() const { return fResHistos; }
     std::vector<std::vector<std::string>> GetResNames() const { return fResNames; }
     Intervals* GetIvs() const { return fIvs; }
+    unsigned int GetNThreads() const { return fNThreads; }
+    bool GetChainIntervals() const { return fChainIntervals; }
     void SetManualPar(const std::string& parname, double value) { fManualPars[parname] = value; }
 
     // Main methods
@@ -143,8 +184,11 @@ private:
     void AddData(double exmin, double exmax);
     void AddModels();
     void ConfigRunner(int iv, Fitters::Runner& runner);
+    // Initial values of the free parameters of interval iv from those fitted in interval from
+    void SeedFromInterval(unsigned int iv, unsigned int from, Fitters::Runner& runner, const std::vector<double>& pars,
+                          std::ostream* out) const;
     void DoCounts(unsigned int iv, int nsigma);
-    void CountsBySum(const std::string& key, unsigned int iv, int nsigma, TF1* f);
+    void CountsBySum(const std::string& key, unsigned int iv, int nsigma, double mean, double sigma);
 };
 } // namespace Angular
 
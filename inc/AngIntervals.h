@@ -1,15 +1,20 @@
 #ifndef AngIntervals_h
 #define AngIntervals_h
 #include "ROOT/RDF/HistoModels.hxx"
+#include "ROOT/RDF/RActionImpl.hxx"
 
 #include "TCanvas.h"
 #include "TH1.h"
 
+#include <memory>
 #include <mutex>
 #include <set>
 #include <string>
 #include <utility>
 #include <vector>
+
+class TTreeReader;
+
 namespace Angular
 {
 class Intervals
@@ -26,6 +31,7 @@ public:
     Intervals(double xmin, double xmax, const ROOT::RDF::TH1DModel& model, double step = -1, int nps = 0);
 
     // Setters
+    // Thread-safe but serialized on a mutex: for event loops use IntervalsFiller instead
     void Fill(double thetaCM, double Ex);
     void FillPS(int idx, double thetaCM, double Ex, double weight);
     // Templates are defined in class header
@@ -50,6 +56,9 @@ public:
     const std::vector<std::pair<double, double>> GetRanges() const { return fRanges; }
     std::vector<TH1D*> GetHistos() const { return fHs; }
     std::vector<std::vector<TH1D*>> GetHistosPS() const { return fHsPS; }
+    // Index of the interval containing thetaCM, -1 if none. O(1) for uniform steps, binary search otherwise
+    // (ranges must be sorted and not overlapping)
+    int FindInterval(double thetaCM) const;
     double GetLow(int i) const { return fRanges[i].first; }
     double GetCenter(int i) const { return (fRanges[i].first + fRanges[i].second) / 2; }
     std::vector<double> GetCenters() const;
@@ -72,6 +81,46 @@ public:
 private:
     double ComputeSolidAngle(double min, double max);
 };
+
+// Lock-free filling of the histograms of Intervals from many threads: each slot fills its own copy (shard) of
+// the histograms of every interval, which are added to those of Intervals by Merge(). Target are the data
+// histograms (ps < 0) or those of phase space ps. Also an RDataFrame action, filling all the intervals in one pass:
+// df.Book<double, double>(Angular::IntervalsFiller {ivs}, {"ThetaCM", "Ex"}) (a third column gives the weight)
+class IntervalsFiller : public ROOT::Detail::RDF::RActionImpl<IntervalsFiller>
+{
+public:
+    using Result_t = Intervals;
+
+private:
+    Intervals* fIvs {};
+    int fPS {-1};
+    std::vector<TH1D*> fTargets {};
+    std::vector<std::vector<std::unique_ptr<TH1D>>> fShards {}; // [slot][iv]
+
+public:
+    // nslots = 0: size of the ROOT implicit MT pool (1 if disabled)
+    IntervalsFiller(Intervals& ivs, int ps = -1, unsigned int nslots = 0);
+
+    // Fill from slot, without locks
+    void Fill(unsigned int slot, double thetaCM, double Ex, double weight = 1)
+    {
+        auto iv {fIvs->FindInterval(thetaCM)};
+        if(iv >= 0)
+            fShards[slot][iv]->Fill(Ex, weight);
+    }
+    // Add the shards to the histograms of Intervals and reset them (call once the loop is over)
+    void Merge();
+    unsigned int GetNSlots() const { return fShards.size(); }
+
+    // RDataFrame action interface
+    std::shared_ptr<Intervals> GetResultPtr() const;
+    void Initialize() {}
+    void InitTask(TTreeReader*, unsigned int slot);
+    void Exec(unsigned int slot, double thetaCM, double Ex) { Fill(slot, thetaCM, Ex); }
+    void Exec(unsigned int slot, double thetaCM, double Ex, double weight) { Fill(slot, thetaCM, Ex, weight); }
+    void Finalize() { Merge(); }
+    std::string GetActionName() const { return "IntervalsFiller"; }
+};
 } // namespace Angular
 
 #endif // !AngInterval_h
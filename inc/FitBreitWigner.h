@@ -0,0 +1,210 @@
+#ifndef FitBreitWigner_h
+#define FitBreitWigner_h
+
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <type_traits>
+#include <variant>
+#include <vector>
+
+namespace Fitters
+{
+// Breit-Wigner with energy dependent width Gamma(x) = Gamma0 * P_l(x) / P_l(mean) (R-matrix theory), used by
+// Voigts with AddBWL. x = Ex, mean = Er, s = separation energy [MeV], mu = reduced mass [MeV/c^2] and
+// R = channel radius [fm]
+namespace BWL
+{
+constexpr double kHbarC {197.3269804};     // MeV*fm
+constexpr double kAlpha {1. / 137.035999}; // fine structure constant
+
+// Functor specialized for each l, with constants precomputed and no type erasure
+template <int L>
+class Shape
+{
+    static_assert(L >= 0 && L <= 2, "BWL::Shape: currently only l = 0, 1, 2 are implemented");
+
+private:
+    double fS {};
+    double fMu {};
+    double fR {};
+    double fA {}; // 2 * mu * R^2 / hbar^2 [1/MeV]
+
+public:
+    Shape() = default;
+    Shape(double s, double mu, double R) : fS(s), fMu(mu), fR(R), fA(2 * mu * R * R / (kHbarC * kHbarC)) {}
+
+    // Ratio of penetrabilities Gamma(x) / Gamma0, for x > s
+    double Penetrability(double x, double mean) const
+    {
+        double ed {x - fS};
+        double r {ed / mean};
+        if constexpr(L == 0)
+            return std::sqrt(r);
+        else if constexpr(L == 1)
+            return r * std::sqrt(r) * (2 * ed / (mean + ed)) * (1. + fA * mean) / (1. + fA * ed);
+        else
+        {
+            double am {fA * mean};
+            double ae {fA * ed};
+            return r * r * std::sqrt(r) * (2 * ed / (mean + ed)) * (9. + 3. * am + am * am) / (9. + 3. * ae + ae * ae);
+        }
+    }
+
+    // Lorentz formula with Gamma(x), zero below threshold
+    double operator()(double x, double mean, double Gamma0) const
+    {
+        if(x <= fS)
+            return 0.0;
+        double Gamma {Gamma0 * Penetrability(x, mean)};
+        return Gamma * 0.159154943 / ((x - mean) * (x - mean) + Gamma * Gamma / 4);
+    }
+
+    // out[i] = f(x[i]) (written, not accumulated)
+    void EvalBatch(const double* x, std::size_t n, double mean, double Gamma0, double* out) const
+    {
+        for(std::size_t i = 0; i < n; i++)
+            out[i] = (*this)(x[i], mean, Gamma0);
+    }
+
+    // Parameters identifying the shape: l, s, mu, R and Z1 * Z2 (neutral)
+    std::array<double, 5> GetPars() const { return {static_cast<double>(L), fS, fMu, fR, 0.}; }
+};
+
+// ln of the Coulomb penetrability P_l = rho / (F_l^2 + G_l^2), with F and G the regular and irregular
+// Coulomb functions at Sommerfeld parameter eta and rho = k * R. Any l, also deep below the barrier
+double CoulombLogPenetrability(int l, double eta, double rho);
+
+// ln P_l of a charged-particle channel tabulated on a logarithmic grid of decay energies [emin, emax] [MeV], with
+// cubic interpolation. Energies outside throw: there is no extrapolation. emin <= 0 tabulates from threshold, down
+// to where P_l underflows (exp(ln P_l) = 0 in double precision), so that lower energies are exactly 0
+class CoulombTable
+{
+private:
+    double fLogEMin {};
+    double fLogStep {};
+    bool fFromThreshold {};
+    std::vector<double> fLogP {};
+
+public:
+    // npoints = 0: 120 points per decade
+    CoulombTable(int l, double z1z2, double mu, double R, double emin, double emax, int npoints = 0);
+
+    double LogP(double e) const;
+    double GetEMin() const { return std::exp(fLogEMin); }
+    double GetEMax() const { return std::exp(fLogEMin + fLogStep * (fLogP.size() - 1)); }
+    bool IsFromThreshold() const { return fFromThreshold; }
+    bool Covers(double emin, double emax) const
+    {
+        return emax <= GetEMax() && (fFromThreshold || (emin > 0 && emin >= GetEMin()));
+    }
+    // Table of the channel covering [emin, emax]. The last one of each channel is cached and reused while it covers
+    // the request; otherwise a wider one is built (thread-safe)
+    static std::shared_ptr<const CoulombTable> Get(int l, double z1z2, double mu, double R, double emin, double emax);
+};
+
+// Breit-Wigner with Coulomb penetrabilities for any l: Gamma(x) = Gamma0 * P_l(x - s) / P_l(mean - s)
+class Coulomb
+{
+private:
+    int fL {};
+    double fS {};
+    double fMu {};
+    double fR {};
+    double fZ1Z2 {};
+    // Penetrabilities on the decay energies it is evaluated on, set by Cover
+    std::shared_ptr<const CoulombTable> fTable {};
+
+public:
+    Coulomb() = default;
+    Coulomb(int l, double s, double mu, double R, double z1z2) : fL(l), fS(s), fMu(mu), fR(R), fZ1Z2(z1z2) {}
+
+    // Tabulate penetrabilities for x in [xmin, xmax] (resonance energies included), keeping the current table if it
+    // covers them. Evaluations outside throw
+    void Cover(double xmin, double xmax);
+
+    double operator()(double x, double mean, double Gamma0) const { return Eval(x, Norm(mean, Gamma0), mean); }
+
+    void EvalBatch(const double* x, std::size_t n, double mean, double Gamma0, double* out) const
+    {
+        // Penetrability at resonance computed once
+        double norm {Norm(mean, Gamma0)};
+        for(std::size_t i = 0; i < n; i++)
+            out[i] = Eval(x[i], norm, mean);
+    }
+
+    std::array<double, 5> GetPars() const { return {static_cast<double>(fL), fS, fMu, fR, fZ1Z2}; }
+
+private:
+    // Gamma0 / P_l(mean - s)
+    double Norm(double mean, double Gamma0) const;
+    // norm = Gamma0 / P_l(mean - s)
+    double Eval(double x, double norm, double mean) const
+    {
+        if(x <= fS)
+            return 0.0;
+        double Gamma {norm * std::exp(fTable->LogP(x - fS))};
+        return Gamma * 0.159154943 / ((x - mean) * (x - mean) + Gamma * Gamma / 4);
+    }
+};
+
+// User-defined Breit-Wigner f(x, mean, Gamma0), as accepted by Model::SetGammaFuncs before the shapes above
+// Its parameters are unknown: each instance (and its copies) gets its own id in the convolution cache key
+class Custom
+{
+public:
+    using Function = std::function<double(double, double, double)>;
+
+private:
+    Function fFunc {};
+    double fId {};
+
+public:
+    Custom() = default;
+    Custom(Function func);
+    // Any callable f(x, mean, Gamma0), e.g. lambdas
+    template <typename F, typename = std::enable_if_t<!std::is_same_v<std::decay_t<F>, Custom> &&
+                                                      !std::is_same_v<std::decay_t<F>, Function> &&
+                                                      std::is_invocable_r_v<double, F, double, double, double>>>
+    Custom(F func) : Custom(Function {std::move(func)})
+    {
+    }
+
+    double operator()(double x, double mean, double Gamma0) const { return fFunc(x, mean, Gamma0); }
+
+    void EvalBatch(const double* x, std::size_t n, double mean, double Gamma0, double* out) const
+    {
+        for(std::size_t i = 0; i < n; i++)
+            out[i] = fFunc(x[i], mean, Gamma0);
+    }
+
+    // l = -1 marks a custom function, followed by its id
+    std::array<double, 5> GetPars() const { return {-1., fId, 0., 0., 0.}; }
+};
+
+// Any of the shapes above, held by value
+using Func = std::variant<Shape<0>, Shape<1>, Shape<2>, Coulomb, Custom>;
+
+// Runtime l to compile-time specialization. Charged channels (z1z2 > 0) use Coulomb penetrabilities
+Func Make(int l, double s, double mu, double R, double z1z2 = 0);
+
+inline double Eval(const Func& f, double x, double mean, double Gamma0)
+{
+    return std::visit([&](const auto& shape) { return shape(x, mean, Gamma0); }, f);
+}
+
+inline void EvalBatch(const Func& f, const double* x, std::size_t n, double mean, double Gamma0, double* out)
+{
+    std::visit([&](const auto& shape) { shape.EvalBatch(x, n, mean, Gamma0, out); }, f);
+}
+
+inline std::array<double, 5> GetPars(const Func& f)
+{
+    return std::visit([](const auto& shape) { return shape.GetPars(); }, f);
+}
+} // namespace BWL
+} // namespace Fitters
+
+#endif // !FitBreitWigner_h
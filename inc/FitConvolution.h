@@ -0,0 +1,93 @@
+#ifndef FitConvolution_h
+#define FitConvolution_h
+
+#include <array>
+#include <complex>
+#include <cstddef>
+#include <functional>
+#include <future>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+namespace Fitters
+{
+// Convolution of a Breit-Wigner (with penetrability) and a normalized Gaussian, tabulated on a uniform grid
+// Immutable once built, so it can be shared by several models and threads
+class ConvTable
+{
+private:
+    double fXMin {};
+    double fStep {};
+    std::vector<double> fY {};
+
+public:
+    ConvTable(double xmin, double xmax, std::vector<double> y);
+
+    // Linear interpolation (and extrapolation out of range, as TGraph::Eval)
+    double Eval(double x) const;
+    // out[i] += amp * Eval(x[i])
+    void EvalBatch(const double* x, std::size_t n, double amp, double* out) const;
+    std::size_t GetSize() const { return fY.size(); }
+};
+
+namespace Convolution
+{
+// In-place radix-2 FFT, size must be a power of 2. Inverse is normalized by 1 / size
+void FFT(std::vector<std::complex<double>>& data, bool inverse);
+
+// Batch form of the function to convolve: out[i] = f(x[i]), i < n
+using Sampler = std::function<void(const double* x, std::size_t n, double* out)>;
+
+// Convolution of f with a normalized Gaussian of width sigma, tabulated at npoints on [xmin, xmax]
+// f is sampled (in a single call) on a uniform grid padded by 8 sigma on each side, so that circular convolution
+// does not wrap around inside [xmin, xmax], and the Gaussian is applied analytically in Fourier space
+// Pure function of its arguments: safe to call from several threads
+std::shared_ptr<const ConvTable> Gaussian(const Sampler& f, double sigma, double xmin, double xmax, int npoints);
+} // namespace Convolution
+
+// Least recently used cache of convolutions, keyed on everything that defines their shape:
+// penetrability (l, s, mu, R, Z1 * Z2), shape parameters (mean, sigma, Gamma0), range and number of points
+// Thread-safe; tables are built outside the lock, and threads asking for a shape being built wait for it, so a
+// shape is never computed twice and misses on different shapes run concurrently
+class ConvCache
+{
+public:
+    using Key = std::array<double, 11>;
+    using Builder = std::function<std::shared_ptr<const ConvTable>()>;
+
+private:
+    // Table, ready once its build finishes, and id of that build
+    struct Entry
+    {
+        Key fKey {};
+        std::shared_future<std::shared_ptr<const ConvTable>> fTable {};
+        unsigned long fBuild {};
+    };
+
+    std::size_t fCapacity {};
+    // Most recently used at front
+    std::list<Entry> fEntries {};
+    std::map<Key, decltype(fEntries)::iterator> fIndex {};
+    mutable std::mutex fMutex {};
+    unsigned long fHits {};
+    unsigned long fMisses {};
+
+public:
+    explicit ConvCache(std::size_t capacity = 128) : fCapacity(capacity) {}
+
+    // Table for key, calling build only if it is not cached
+    std::shared_ptr<const ConvTable> Get(const Key& key, const Builder& build);
+    void Clear();
+
+    unsigned long GetHits() const;
+    unsigned long GetMisses() const;
+    std::size_t GetSize() const;
+    void Print() const;
+};
+} // namespace Fitters
+
+#endif // !FitConvolution_h
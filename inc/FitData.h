@@ -3,37 +3,114 @@
 
 #include "TH1.h"
 
+#include <cstddef>
+#include <memory>
+#include <mutex>
 #include <vector>
 namespace Fitters
 {
+// Binned data. By default, contents, errors and weights are copied once, so the Data does not depend on its source.
+// Uniform axes store no per-bin arrays: centres and edges are derived from the first edge and the bin width.
+// Owned and derived arrays are shared by copies, so copying a Data only copies pointers
 class Data
 {
+public:
+    // Tag of the non-owning constructors
+    struct View
+    {
+    };
+
 private:
-    std::vector<double> fX {};
-    std::vector<double> fY {};
+    // Array built on first request and shared by copies (thread-safe)
+    struct LazyArray
+    {
+        std::once_flag fFlag {};
+        std::vector<double> fValues {};
+    };
+
+    // Arrays of fSize (edges: fSize + 1, contiguous), owned or viewed. Centres and edges are null when derived
+    const double* fX {};       //! bin centres (if not at the middle of the bins)
+    const double* fY {};       //! bin contents
+    const double* fEdges {};   //! bin edges (variable width)
+    const double* fErrors {};  //! per-bin uncertainties (optional)
+    const double* fWeights {}; //! per-bin weights of the FCN terms (optional)
+    // Owned copies (null for views)
+    std::shared_ptr<const std::vector<double>> fXStore {};       //!
+    std::shared_ptr<const std::vector<double>> fYStore {};       //!
+    std::shared_ptr<const std::vector<double>> fEdgesStore {};   //!
+    std::shared_ptr<const std::vector<double>> fErrorsStore {};  //!
+    std::shared_ptr<const std::vector<double>> fWeightsStore {}; //!
+    // Contiguous centres and edges, only for consumers requesting the full arrays
+    std::shared_ptr<LazyArray> fLazyX {};     //!
+    std::shared_ptr<LazyArray> fLazyEdges {}; //!
+    // Data-only term of the Baker-Cousins likelihood in each bin: y ln(y) - y (0 if y = 0). Only built for it
+    std::shared_ptr<LazyArray> fYLogY {}; //!
+    // Prefix sums (fSize + 1, starting at 0) of contents and of variances (errors^2, or contents if none)
+    std::shared_ptr<const std::vector<double>> fCumY {};   //!
+    std::shared_ptr<const std::vector<double>> fCumVar {}; //!
     double fXLow {};
     double fXUp {};
+    double fEdge0 {}; //! low edge of the first bin
     double fBinWidth {};
+    bool fUniform {true};
     unsigned int fSize {};
 
 public:
-    Data(const TH1D& h, double xlow, double xup) : fXLow(xlow), fXUp(xup) { Fill(h); };
+    Data() = default;
+    // Copy of the bins of h with centre in [xlow, xup], fixed or variable width
+    // withErrors: use the histogram bin errors in the chi2 instead of the default counting estimate
+    Data(const TH1D& h, double xlow, double xup, bool withErrors = false);
+    // Copy of n bins given by their centres x and contents y. Optional: n + 1 contiguous edges (uniform bins
+    // around the centres if not given), per-bin errors and per-bin weights
+    Data(const double* x, const double* y, std::size_t n, const double* edges = nullptr,
+         const double* errors = nullptr, const double* weights = nullptr);
+    // Same without copies: the arrays must outlive the Data and all its copies, and must not change while they
+    // are in use (prefix sums and likelihood terms are derived once)
+    Data(View, const double* x, const double* y, std::size_t n, const double* edges = nullptr,
+         const double* errors = nullptr, const double* weights = nullptr);
+    // Contents y (size of bins) on the bins, errors and weights of bins, which are shared. y is not copied: same
+    // lifetime requirements as above
+    Data(View, const Data& bins, const double* y);
 
     // Getters
     double GetXLow() const { return fXLow; }
     double GetXUp() const { return fXUp; }
+    // Width of uniform bins; mean width for variable ones
     double GetBinWidth() const { return fBinWidth; }
-    double GetX(unsigned int i) { return fX[i]; }
-    double GetY(unsigned int i) { return fY[i]; }
+    double GetBinWidth(unsigned int i) const { return fEdges ? fEdges[i + 1] - fEdges[i] : fBinWidth; }
+    bool IsUniform() const { return fUniform; }
+    double GetX(unsigned int i) const { return fX ? fX[i] : 0.5 * (GetXLowEdge(i) + GetXUpEdge(i)); }
+    double GetY(unsigned int i) const { return fY[i]; }
+    // Contiguous arrays. Centres and edges are built on first call when derived
+    const double* GetX() const;
+    const double* GetY() const { return fY; }
+    const double* GetEdges() const;
+    const double* GetErrors() const { return fErrors; }
+    const double* GetWeights() const { return fWeights; }
+    bool HasErrors() const { return fErrors; }
+    bool HasWeights() const { return fWeights; }
+    const double* GetYLogY() const;
     unsigned int GetSize() const { return fSize; }
-    double GetXLowEdge(unsigned int i) { return fX[i] - 0.5 * fBinWidth; }
-    double GetXUpEdge(unsigned int i) { return fX[i] + 0.5 * fBinWidth; }
+    double GetXLowEdge(unsigned int i) const { return fEdges ? fEdges[i] : fEdge0 + i * fBinWidth; }
+    double GetXUpEdge(unsigned int i) const { return GetXLowEdge(i + 1); }
+    // Centres of bins [begin, end) into out, without building the full array
+    void FillX(unsigned int begin, unsigned int end, double* out) const;
+    // Edges of bins [begin, end) into out (end - begin + 1 values)
+    void FillEdges(unsigned int begin, unsigned int end, double* out) const;
     int GetBin(double x) const;
+    // Sum of contents in bins [GetBin(xmin), GetBin(xmax)], in O(1) from prefix sums
     double Integral(double xmin, double xmax) const;
+    // And its uncertainty: sqrt of the sum of errors^2 (of contents when data has no errors)
+    double IntegralError(double xmin, double xmax) const;
+    // Same on bins [low, up]
+    double IntegralBins(unsigned int low, unsigned int up) const;
+    double IntegralErrorBins(unsigned int low, unsigned int up) const;
     void Print() const;
 
 private:
-    void Fill(const TH1D& h);
+    // Axis from edges (or from centres if no edges), dropping owned arrays that a uniform axis derives
+    void InitAxis();
+    void Init();
 };
 }; // namespace Fitters
 
@@ -0,0 +1,42 @@
+#ifndef FitKernels_h
+#define FitKernels_h
+
+#include <cstddef>
+
+namespace Fitters
+{
+// Batch kernels used by Model::EvalBatch
+// All of them accumulate into out: out[i] += amp * f(x[i])
+// Loops are branch-free and compiled for AVX-512, AVX2 and a scalar fallback (runtime dispatch, x86-64 with GCC)
+namespace Kernels
+{
+void Gauss(const double* x, std::size_t n, double amp, double mean, double sigma, double* out);
+
+// Derivatives of amp * gaus with respect to amp, mean and sigma (written, not accumulated)
+void GaussGrad(const double* x, std::size_t n, double amp, double mean, double sigma, double* dAmp, double* dMean,
+               double* dSigma);
+
+// Bin averages of amp * gaus over contiguous bins [edges[i], edges[i + 1]], i < n (closed erf form, not vectorized)
+void GaussBinAverage(const double* edges, std::size_t n, double amp, double mean, double sigma, double* out);
+// And their derivatives with respect to amp, mean and sigma (written, not accumulated; null rows skipped)
+void GaussBinAverageGrad(const double* edges, std::size_t n, double amp, double mean, double sigma, double* dAmp,
+                         double* dMean, double* dSigma);
+
+// Reference Voigt: TMath::Voigt point by point (not vectorized)
+void Voigt(const double* x, std::size_t n, double amp, double mean, double sigma, double lg, double* out);
+
+// Fast Voigt: Weideman's approximation of the Faddeeva function in real arithmetic (see FitVoigt.h)
+void VoigtFast(const double* x, std::size_t n, double amp, double mean, double sigma, double lg, double* out);
+
+void Constant(std::size_t n, double amp, double* out);
+
+void Scaled(const double* in, std::size_t n, double amp, double* out);
+
+void Exp(const double* in, std::size_t n, double* out);
+
+// Natural log (written, not accumulated). Inputs below the smallest normal double are clamped to it
+void Log(const double* in, std::size_t n, double* out);
+} // namespace Kernels
+} // namespace Fitters
+
+#endif // !FitKernels_h
@@ -1,14 +1,18 @@
 #ifndef FitModel_h
 #define FitModel_h
 
-#include "TF1.h"
-#include "TF1Convolution.h"
 #include "TH1.h"
 #include "TSpline.h"
 
 #include "Math/IParamFunction.h"
 
-#include <functional>
+#include "FitBreitWigner.h"
+#include "FitConvolution.h"
+#include "FitVoigt.h"
+
+#include <array>
+#include <cstddef>
+#include <iostream>
 #include <map>
 #include <memory>
 #include <string>
@@ -18,18 +22,48 @@
 
 namespace Fitters
 {
-class Model : public ROOT::Math::IParametricFunctionMultiDimTempl<double>
+class Model : public ROOT::Math::IParametricGradFunctionMultiDimTempl<double>
 {
 public:
     typedef std::vector<std::vector<double>> ParPack;
     typedef std::vector<ParPack> ParVec;
-    using GammaFunc = std::function<double(double, double, double)>;
+    // Breit-Wigner with penetrability of a voigt (see FitBreitWigner.h)
+    using GammaFunc = BWL::Func;
+    // Kind of inner function
+    enum class FuncType
+    {
+        kGauss,
+        kVoigt,
+        kPS,
+        kCte
+    };
+    // Entry of the flat parameter layout: kind of function, index within its kind
+    // and position of its first parameter in the c-like parameter array
+    struct Component
+    {
+        FuncType fType {};
+        int fIdx {};
+        unsigned int fOffset {};
+        unsigned int fNPar {};
+    };
+
+    // Phase spaces sampled once on a uniform grid x0 + i * step, i < n
+    struct PSGrid
+    {
+        double fX0 {};
+        double fStep {};
+        std::size_t fN {};
+        bool fUseSpline {};
+        std::vector<std::vector<double>> fSamples {}; // [ps][i]
+    };
 
 private:
     // PS data (by copied histograms)
     std::vector<TH1D> fPS {};
     // Splines of PS to plot global fit
     std::vector<std::shared_ptr<TSpline3>> fSpePS {};
+    // PS sampled on the grids of the fit (data and divisions)
+    std::vector<PSGrid> fPSGrids {}; //!
     // Number of inner functions to use: gauss, voigt, ps and cte
     int fNGauss {};
     int fNVoigt {};
@@ -44,16 +78,26 @@ private:
     // Parameters
     std::vector<double> fPars {};
     std::vector<std::string> fParNames {};
-    std::vector<std::pair<std::string, unsigned int>> fChart;
+    // Flat parameter layout, built once in constructor
+    std::vector<Component> fComponents {};
     // Store penetrability functions for each voigt
-    std::map<int, GammaFunc> fGammaFuncs {};
-    std::map<int, std::shared_ptr<TF1>> fGaussians {};
-    std::map<int, std::shared_ptr<TF1>> fBWs {};
-    std::map<int, std::shared_ptr<TF1Convolution>> fConvObjs;
-    // Number of points to compute convolution (integral) for each value of Ex
+    std::map<int, GammaFunc> fGammaFuncs {}; //!
+    // Cache of tabulated convolutions, may be shared between models
+    std::shared_ptr<ConvCache> fConvCache {}; //!
+    // Shifted shapes of the finite-difference derivatives, of this model only: they do not evict those of fConvCache
+    std::shared_ptr<ConvCache> fGradConvCache {}; //!
+    // Convolutions for the current shape parameters and range
+    std::map<int, std::shared_ptr<const ConvTable>> fConvTables {}; //!
+    std::pair<double, double> fConvRange {};
+    // Number of points of the convolution tables in the fit range (10000 if not set)
     int fNConvolutionPoints {};
+    // Convolutions computed by this model (not found in cache)
+    mutable unsigned long fNConvolutions {}; //!
+    // Rows of derivatives not requested but written by the kernels, reused across calls
+    mutable std::vector<double> fGradScratch {}; //!
     // Configuration options
     bool fUseSpline {false};
+    Voigt::Mode fVoigtMode {Voigt::Mode::kReference};
 
 public:
     // Constructor
@@ -73,58 +117,107 @@ public:
     }
 
     // Derived functions from IBaseFunction
-    Model* Clone() const override
-    {
-        auto ret {new Model {fNGauss, fNVoigt, fPS, fCte}};
-        ret->SetParameters(Parameters());
-        ret->SetUseSpline(fUseSpline);
-        ret->SetGammaFuncs(fGammaFuncs);
-        ret->SetBWs(fBWs);
-        ret->SetGaussians(fGaussians);
-        ret->SetConvObjs(fConvObjs);
-        return ret;
-    };
-    bool HasGradient() const override { return false; }
+    // Thread-safe: ROOT objects (phase spaces and their splines) are copied one clone at a time
+    // Tables of convolutions are immutable and shared; the cache of convolutions is shared and locked
+    Model* Clone() const override;
+    bool HasGradient() const override { return true; }
     unsigned int NDim() const override { return 1; }
 
     // Custom getters and setters
     void SetUseSpline(bool use) { fUseSpline = use; }
     bool GetUseSpline() const { return fUseSpline; }
+    // Accuracy tier of Voigts without penetrability (see FitVoigt.h for tolerances)
+    void SetVoigtMode(Voigt::Mode mode) { fVoigtMode = mode; }
+    Voigt::Mode GetVoigtMode() const { return fVoigtMode; }
     double EvalPS(unsigned int i, double x) const;
+    // Sample phase spaces once on a uniform grid (non-uniform grids are ignored)
+    // Batch evaluation on this grid, or on any contiguous part of it, then reads the samples
+    void SamplePS(const double* x, std::size_t n);
+    // Same on the grid x0 + i step, i < n
+    void SamplePS(double x0, double step, std::size_t n);
+    void ClearPSSamples() { fPSGrids.clear(); }
     double EvalWithPacks(double x, ParPack& gaus, ParPack& voigt, ParPack& phase, ParPack& cte) const;
+    // Evaluation reading directly from the c-like parameter array
+    double Eval(double x, const double* p) const;
+    double EvalComponent(const Component& comp, double x, const double* p) const;
+    // Batch evaluation over a grid of n points: components outer, points inner
+    void EvalBatch(const double* x, std::size_t n, const double* p, double* out) const;
+    void EvalComponentBatch(const Component& comp, const double* x, std::size_t n, const double* p, double* out) const;
+
+    // Bin averages over contiguous bins [edges[i], edges[i + 1]], i < n
+    // Available for gaussians (erf), plain voigts (Gauss-Legendre on each bin) and constant
+    bool HasBinAverage(const Component& comp) const;
+    // Size of the scratch buffer for n bins, proportional to n: callers keep it across calls
+    static std::size_t GetBinAverageScratch(std::size_t n);
+    // Accumulates into out
+    void EvalComponentBinAverage(const Component& comp, const double* edges, std::size_t n, const double* p,
+                                 double* out, double* scratch) const;
+    // Overwrites rows, as EvalComponentGradBatch
+    void EvalComponentBinAverageGrad(const Component& comp, const double* edges, std::size_t n, const double* p,
+                                     double* const* rows, double* scratch) const;
+    // Integral over [xmin, xmax] of a gaussian (erf) or of a voigt (plain profile, see Voigt::Integral), as the
+    // counts of peaks are computed
+    double IntegralComponent(const Component& comp, const double* p, double xmin, double xmax) const;
+
+    // Derived function from IParametricGradFunctionMultiDim
+    void ParameterGradient(const double* x, const double* p, double* grad) const override;
+    // Derivatives of one component: rows[k][i] = df(x[i]) / dp[comp.fOffset + k]
+    // Null rows are not needed by the caller and may be skipped
+    void EvalComponentGradBatch(const Component& comp, const double* x, std::size_t n, const double* p,
+                                double* const* rows) const;
+
+    // Parameter layout
+    const std::vector<Component>& GetComponents() const { return fComponents; }
+    unsigned int GetOffset(FuncType type, int idx) const;
+    std::string GetComponentLabel(const Component& comp) const;
 
     // Other custom functions to get type func and idx from par name and viceversa
     unsigned int GetIdxFromLabel(const std::string& typeIdx, unsigned int par) const;
     ParVec UnpackParameters(const double* pars) const;
 
-    void Print() const;
+    void Print(std::ostream& out = std::cout) const;
 
     // Add option to have penetrabilities
-    void AddBWL(int vIdx, int l, double s, double mu, double R);
+    // Neutral channels (z1z2 = 0) for l = 0, 1, 2; charged ones use tabulated Coulomb penetrabilities, any l
+    void AddBWL(int vIdx, int l, double s, double mu, double R, double z1z2 = 0);
     void SetGammaFuncs(const std::map<int, GammaFunc>& funcs) { fGammaFuncs = funcs; }
+    // User-defined Breit-Wigners f(x, mean, Gamma0) of each voigt (see BWL::Custom)
+    void SetGammaFuncs(const std::map<int, BWL::Custom::Function>& funcs);
     const std::map<int, GammaFunc>& GetGammaFuncs() const { return fGammaFuncs; }
-    void SetBWs(const std::map<int, std::shared_ptr<TF1>>& bws) { fBWs = bws; }
-    const std::map<int, std::shared_ptr<TF1>>& GetBWs() const { return fBWs; }
-    void SetGaussians(const std::map<int, std::shared_ptr<TF1>>& gauss) { fGaussians = gauss; }
-    const std::map<int, std::shared_ptr<TF1>>& GetGaussians() const { return fGaussians; }
-    void SetConvObjs(const std::map<int, std::shared_ptr<TF1Convolution>>& convObjs) { fConvObjs = convObjs; }
-    const std::map<int, std::shared_ptr<TF1Convolution>>& GetConvObjs() const { return fConvObjs; }
-    // Function to evaluate manual convolution with Gaussian
+    void SetNConvolutionPoints(int n) { fNConvolutionPoints = n; }
+    int GetNConvolutionPoints() const { return fNConvolutionPoints; }
+    // Points actually used (10000 if not set)
+    int GetConvolutionPoints() const { return (fNConvolutionPoints > 0) ? fNConvolutionPoints : 10000; }
+    unsigned long GetNConvolutions() const { return fNConvolutions; }
+    // Share a cache of convolutions between models (e.g. intervals with identical shapes)
+    void SetConvCache(const std::shared_ptr<ConvCache>& cache) { fConvCache = cache; }
+    std::shared_ptr<ConvCache> GetConvCache() const { return fConvCache; }
+    // Function to evaluate manual convolution with Gaussian (FFT engine in FitConvolution.h)
+    // Only shapes not found in the cache are computed again
     void TriggerConvolution(const double* p, double xMin, double xMax);
 
 private:
     void InitSplines();
     void InitFuncParNames();
     void InitParNames();
+    void InitLayout();
+    // Samples of phase space idx on x, if x is part of a sampled grid. nullptr otherwise
+    const double* FindPSSamples(int idx, const double* x, std::size_t n) const;
+    bool HasPSGrid(double x0, double step, std::size_t n) const;
+    // Gauss-Legendre nodes of each bin (n * 6), used for voigt bin averages
+    void BuildBinNodes(const double* edges, std::size_t n, double* nodes) const;
     std::pair<std::string, int> GetTypeIdx(const std::string& name) const;
     // Override of IBaseFunction
     double DoEvalPar(const double* x, const double* p) const override;
-    // Function to initialize penetrability function for given l, s, mu and R
-    GammaFunc InitLambda(int l, double s, double mu, double R);
-    // Helper methods
-    void InitOrUpdateBW(int vIdx, double mean, double Gamma0, double xMin, double xMax);
-    void InitOrUpdateGaussian(int vIdx, double sigma, double xMin, double xMax);
-    void InitOrUpdateConvolution(int vIdx, double mean, double sigma, double Gamma0, double xMin, double xMax);
+    // Override of IParametricGradFunctionMultiDim
+    double DoParameterDerivative(const double* x, const double* p, unsigned int ipar) const override;
+    // Derivatives of a Voigt with penetrability, by finite differences on the convolution
+    void EvalConvolutionGradBatch(const Component& comp, const double* x, std::size_t n, const double* p,
+                                  double* const* rows) const;
+    // Table of convolution for given shape, from cache or computed by Convolution::Gaussian
+    std::shared_ptr<const ConvTable> GetConvTable(int vIdx, double mean, double sigma, double Gamma0,
+                                                  const std::shared_ptr<ConvCache>& cache) const;
+    const ConvTable& GetCurrentConvTable(int vIdx) const;
 };
 } // namespace Fitters
 
@@ -5,12 +5,17 @@
 
 #include "FitData.h"
 #include "FitModel.h"
+#include "FitStats.h"
+#include "FitThreadPool.h"
 
+#include <cstddef>
+#include <iostream>
 #include <memory>
+#include <vector>
 
 namespace Fitters
 {
-class Objective : public ROOT::Math::IBaseFunctionMultiDimTempl<double>
+class Objective : public ROOT::Math::IGradientFunctionMultiDimTempl<double>
 {
 private:
     // Pointer to model
@@ -23,6 +28,30 @@ private:
     int fNdiv {20};
     // Use built-in ROOT integrator
     bool fUseIntegral {};
+    // Use closed-form bin averages where available, divisions (if enabled) or bin centres otherwise
+    bool fUseBinAverage {};
+    // Baker-Cousins Poisson likelihood instead of chi2
+    bool fUseLikelihood {};
+    // Offer the analytic gradient to the minimizer (HasGradient)
+    bool fUseGradient {};
+    // Workers for parallel evaluation, shared with clones
+    std::shared_ptr<ThreadPool> fPool {}; //!
+    // Counters of evaluations, shared with plain clones (as the one held by the fitter). Null if disabled
+    std::shared_ptr<FitStats> fStats {}; //!
+    // Parameters fixed in the fit: their derivatives are skipped
+    std::vector<bool> fFixed {};
+    // Buffers reused across FCN calls
+    mutable std::vector<double> fYFit {}; //! model evaluated at each bin
+    mutable std::vector<double> fDChi2 {}; //! derivative of chi2 with respect to each fYFit
+    mutable std::vector<double> fRows {}; //! derivatives of one component on the evaluation grid
+    mutable std::vector<double> fGrad {}; //! full gradient, for single derivative calls
+    mutable std::vector<double> fXDiv {}; //! grid of divisions
+    mutable std::vector<double> fYDiv {}; //! model evaluated at each division
+    mutable std::vector<double> fPartial {}; //! chi2 of each chunk of bins
+    mutable std::vector<double> fLogFit {}; //! ln of fYFit, for likelihood
+    mutable std::vector<double> fScratch {}; //! nodes and values of bin averages, proportional to bins
+    // Bins per chunk, with or without pool: fixed, so the reduction order does not depend on the number of threads
+    static constexpr unsigned int fChunkSize {256};
 
 public:
     Objective() = default;
@@ -36,28 +65,69 @@ public:
 
     // Override methods
     unsigned int NDim() const override { return fModel->NPar(); }
-    Objective* Clone() const override { return new Objective {fData, fModel}; }
+    Objective* Clone() const override { return new Objective {*this}; }
+    // Copy with its own clone of the model and serial evaluation: safe to use concurrently with this one
+    Objective CloneDetached() const;
+    void Gradient(const double* p, double* grad) const override;
+    // Minimizers check it on the function itself: false keeps them on their own numerical derivatives
+    bool HasGradient() const override { return fUseGradient; }
 
     // Getters
     std::shared_ptr<Data> GetData() const { return fData; }
     std::shared_ptr<Model> GetModel() const { return fModel; }
     bool GetUseIntegral() const { return fUseIntegral; }
     bool GetUseDivisions() const { return fUseDivisions; }
+    bool GetUseBinAverage() const { return fUseBinAverage; }
+    bool GetUseLikelihood() const { return fUseLikelihood; }
+    bool GetUseGradient() const { return fUseGradient; }
     int GetNdiv() const { return fNdiv; }
+    unsigned int GetNThreads() const { return fPool ? fPool->GetNThreads() : 1; }
+    std::shared_ptr<FitStats> GetStats() const { return fStats; }
 
     // Setters
     void SetUseIntegral(bool use) { fUseIntegral = use; }
     void SetUseDivisions(bool use) { fUseDivisions = use; }
+    void SetUseBinAverage(bool use) { fUseBinAverage = use; }
+    void SetUseLikelihood(bool use) { fUseLikelihood = use; }
+    void SetUseGradient(bool use) { fUseGradient = use; }
     void SetNdiv(int div) { fNdiv = div; }
+    // Evaluate chunks of bins in parallel (n > 1) or serially (n <= 1)
+    void SetNThreads(unsigned int n);
+    void SetFixedPars(const std::vector<bool>& fixed) { fFixed = fixed; }
+    // Count calls and time spent in each stage. When disabled, each counter costs one branch
+    void SetUseStats(bool use);
+    // Evaluation grids are kept if data has the same bins as the current one, rebuilt otherwise
+    void SetData(const std::shared_ptr<Data>& data);
 
     // Others
-    void Print() const;
+    // Contents expected in each bin at parameters p, evaluated as in the FCN
+    void Expected(const double* p, double* out) const;
+    void Print(std::ostream& out = std::cout) const;
 
 private:
     double DoEval(const double* p) const override;
+    double DoEvalChunks(const double* p) const;
+    void EvalModel(const double* p) const;
+    void TriggerConvolution(const double* p) const;
+    // As Model::EvalBatch, timing each component
+    void EvalComponents(const double* x, std::size_t n, const double* p, double* out) const;
+    double* ComponentTimer(unsigned int i) const { return (fStats && !fPool) ? &fStats->fComponentTime[i] : nullptr; }
+    void PrepareGrids() const;
+    // Ranges of at most one chunk of bins
+    void EvalModelRange(const double* p, unsigned int begin, unsigned int end) const;
+    double FCNRange(unsigned int begin, unsigned int end) const;
+    double Chi2Range(unsigned int begin, unsigned int end) const;
+    double LikelihoodRange(unsigned int begin, unsigned int end) const;
     double DoEvalWithIntegral(int i, const double* p) const;
-    double DoEvalWithDivisions(double x, const double* p) const;
-    double DoEvalSigma(double nexp, double nfit) const;
+    void DoEvalWithDivisions(const double* p, unsigned int begin, unsigned int end) const;
+    void DoEvalWithBinAverage(const double* p, unsigned int begin, unsigned int end) const;
+    void BuildDivisions() const;
+    void AverageDivisions(unsigned int begin, unsigned int end) const;
+    double DoEvalSigma(unsigned int i, double nexp, double nfit) const;
+    double BinWeight(unsigned int i) const { return fData->HasWeights() ? fData->GetWeights()[i] : 1; }
+    double DoDerivative(const double* p, unsigned int icoord) const override;
+    void DoNumericalGradient(const double* p, double* grad) const;
+    bool IsFixed(unsigned int i) const { return i < fFixed.size() && fFixed[i]; }
 };
 } // namespace Fitters
 
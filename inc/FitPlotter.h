@@ -29,9 +29,6 @@ public:
     TGraph* GetGlobalFit();
 
     std::unordered_map<std::string, TH1D*> GetIndividualHists();
-
-private:
-    void FillHistoFromFunc(TH1D* h, TF1* f);
 };
 } // namespace Fitters
 
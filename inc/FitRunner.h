@@ -2,14 +2,25 @@
 #define FitRunner_h
 
 #include "TFitResult.h"
+#include "TGraph.h"
+#include "TGraph2D.h"
 
+#include "Fit/FitResult.h"
 #include "Fit/Fitter.h"
 
 #include "FitModel.h"
 #include "FitObjective.h"
+#include "FitStats.h"
 
+#include <cstddef>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <random>
 #include <string>
 #include <unordered_map>
+#include <utility>
 #include <vector>
 namespace Fitters
 {
@@ -23,10 +34,96 @@ public:
     typedef std::unordered_map<std::string, PairVec> Bounds;
     typedef std::unordered_map<std::string, BoolVec> Fixed;
     typedef std::unordered_map<std::string, DoubleVec> Step;
+    // Sampling of starting points of a multi-start fit
+    enum class StartMode
+    {
+        kUniform,
+        kLatinHypercube
+    };
+    // Minima found by a multi-start fit, indexed by start (start 0 is the configured initial point)
+    struct MultiStartStats
+    {
+        std::vector<DoubleVec> fStarts {};
+        std::vector<DoubleVec> fParams {};
+        DoubleVec fMinima {};
+        BoolVec fValid {};
+        int fBest {-1};
+        // Spread of valid minima: standard deviation, and number of them within fTolerance of the best
+        double fStdDev {};
+        unsigned int fNAtBest {};
+        double fTolerance {0.01};
+    };
+    // Resampling of data contents in a bootstrap
+    enum class ResampleMode
+    {
+        kPoisson,    // each bin independently, total varies
+        kMultinomial // total fixed to the one of data
+    };
+    // Refits of resampled data, indexed by replica
+    struct BootstrapStats
+    {
+        DoubleVec fNominal {};
+        std::vector<DoubleVec> fParams {};
+        // Counts predicted in the fit range by each gaussian and voigt, keyed by component label (g0, v0, ...)
+        std::map<std::string, double> fNominalCounts {};
+        std::map<std::string, DoubleVec> fCounts {};
+        BoolVec fValid {};
+
+        // Central percentile interval of valid replicas at confidence level cl
+        std::pair<double, double> ParInterval(unsigned int ipar, double cl = 0.6827) const;
+        std::pair<double, double> CountsInterval(const std::string& key, double cl = 0.6827) const;
+    };
+    // Fits of pseudo-spectra sampled from the fitted model, indexed by toy
+    struct ToyStats
+    {
+        DoubleVec fTruth {};
+        std::vector<DoubleVec> fParams {};
+        std::vector<DoubleVec> fErrors {};
+        DoubleVec fMinima {};
+        BoolVec fValid {};
+        // Goodness of fit: minimum of data and fraction of valid toys with a larger one (-1 if none)
+        double fDataMinimum {};
+        double fPValue {-1};
+        double fToysPerSecond {};
+
+        // (fit - truth) / error of valid toys
+        DoubleVec Pulls(unsigned int ipar) const;
+    };
+    // Fills the n contents of a replica from the given engine
+    using Sampler = std::function<void(std::mt19937_64&, double*)>;
+    // Receives each replica fit: index, objective (with the replica data), result and validity
+    using Collector = std::function<void(std::size_t, const Objective&, const ROOT::Fit::FitResult&, bool)>;
 
 private:
     ROOT::Fit::Fitter fFitter;
     Objective fObj;
+    // Last result, with MINOS errors merged from parallel workers
+    ROOT::Fit::FitResult fResult {};
+    // Profile likelihood scans: DeltaFCN versus parameter value(s), keyed by parameter name(s)
+    std::map<std::string, std::shared_ptr<TGraph>> fProfiles {};
+    std::map<std::string, std::shared_ptr<TGraph2D>> fProfiles2D {};
+    // Threads for MINOS, one parameter per task
+    unsigned int fNThreadsMinos {1};
+    // Pass analytic gradient of objective to minimizer
+    bool fUseGradient {};
+    // Result of last multi-start fit
+    MultiStartStats fMultiStart {};
+    // Result of last bootstrap
+    BootstrapStats fBootstrap {};
+    // Result of last toy study
+    ToyStats fToys {};
+    // Seed each fit from the last minimum
+    bool fUseWarmStart {};
+    // With warm start, return the last minimum if the configuration did not change
+    bool fReuseMinimum {};
+    // Last minimum: parameters, errors and signature of the configuration it was found with
+    DoubleVec fLastPars {};
+    DoubleVec fLastErrors {};
+    DoubleVec fLastConfig {};
+    bool fHasLast {};
+    bool fLastValid {};
+    // Destination of every print of the runner
+    std::ostream* fOut {&std::cout}; //!
 
 public:
     Runner() = default;
@@ -37,19 +134,95 @@ public:
     void SetBounds(const Bounds& bounds);
     void SetFixed(const Fixed& fixed);
     void SetStep(const Step& step);
+    void SetUseGradient(bool use);
+    void SetUseLikelihood(bool use) { fObj.SetUseLikelihood(use); }
+    // Instrument the objective: counters of the last Fit() are printed with its result and written by Write()
+    void SetUseStats(bool use);
+    // Refits start from the last minimum (values clamped to current bounds) and its errors as step sizes (the
+    // configured ones are restored after the fit)
+    void SetUseWarmStart(bool use) { fUseWarmStart = use; }
+    // With warm start, a refit with unchanged bounds, fixed parameters, objective, minimizer and model settings
+    // skips MIGRAD and only runs HESSE/MINOS if asked. Data with the same binning and total contents, or new gamma
+    // functions on the same voigts, are not detected: call ResetWarmStart() after such changes
+    void SetReuseMinimum(bool reuse) { fReuseMinimum = reuse; }
+    // Forget the last minimum: next fit starts from the configured initial values
+    void ResetWarmStart() { fHasLast = false; }
+    // Run MINOS of each parameter concurrently, each on its own clone of the objective (n > 1)
+    void SetNThreadsMinos(unsigned int n) { fNThreadsMinos = n; }
+    // Send every print of the runner to out (e.g. a buffer when fitting concurrently), which must outlive the
+    // calls. Minuit prints to stdout by itself: set its print level to 0 in that case
+    void SetOutput(std::ostream& out) { fOut = &out; }
 
     // Getters
     ROOT::Fit::Fitter& GetFitter() { return fFitter; }
-    TFitResult GetFitResult() const { return TFitResult {fFitter.Result()}; }
+    TFitResult GetFitResult() const { return TFitResult {fResult}; }
     Objective& GetObjective() { return fObj; }
+    bool GetUseGradient() const { return fUseGradient; }
+    const MultiStartStats& GetMultiStartStats() const { return fMultiStart; }
+    const BootstrapStats& GetBootstrapStats() const { return fBootstrap; }
+    const ToyStats& GetToyStats() const { return fToys; }
+    // Counters of the last Fit(), null if not enabled
+    std::shared_ptr<const FitStats> GetStats() const { return fObj.GetStats(); }
+    bool GetUseWarmStart() const { return fUseWarmStart; }
+    bool GetReuseMinimum() const { return fReuseMinimum; }
+    unsigned int GetNThreadsMinos() const { return fNThreadsMinos; }
+    const std::map<std::string, std::shared_ptr<TGraph>>& GetProfiles() const { return fProfiles; }
+    const std::map<std::string, std::shared_ptr<TGraph2D>>& GetProfiles2D() const { return fProfiles2D; }
 
     // Other methods
     bool Fit(bool print = true, bool hesse = false, bool minos = false);
+    // Runs nstarts independent MIGRADs, nthreads at a time, from points sampled inside the bounds of the free
+    // parameters (parameters without both bounds keep their initial value). Each start fits its own clone of
+    // model and objective; starts are drawn from seed before any fit, so results do not depend on nthreads
+    // The best minimum is then refitted by Fit(print, hesse, minos), which sets the result of this runner
+    bool FitMultiStart(unsigned int nstarts, unsigned int nthreads = 1, unsigned long seed = 1,
+                       StartMode mode = StartMode::kLatinHypercube, bool print = true, bool hesse = false,
+                       bool minos = false);
+
+    // Refits nreplicas copies of data resampled around its contents, nthreads at a time, each one starting from the
+    // last minimum with its errors as steps. Replica r draws from its own stream seeded by (seed, r), so results
+    // do not depend on nthreads. Requires a previous Fit()
+    bool Bootstrap(unsigned int nreplicas, unsigned int nthreads = 1, unsigned long seed = 1,
+                   ResampleMode mode = ResampleMode::kPoisson, bool print = true);
+
+    // Samples ntoys Poisson pseudo-spectra on the data bins from the model at the last minimum and refits them as
+    // Bootstrap does, nthreads at a time. Gives pulls and the goodness-of-fit p-value of the data minimum
+    bool FitToys(unsigned int ntoys, unsigned int nthreads = 1, unsigned long seed = 1, bool print = true);
+
+    // Profile likelihood scans around the last minimum: at each point the scanned parameters are fixed and the
+    // rest minimized again. Points are fitted concurrently on clones of the objective
+    // Without a range (min >= max), value +- 3 errors, within bounds
+    TGraph* ProfileScan(unsigned int ipar, unsigned int npoints, double min = 0, double max = 0,
+                        unsigned int nthreads = 1);
+    TGraph2D* ProfileScan2D(unsigned int ipar, unsigned int jpar, unsigned int npoints, double imin = 0,
+                            double imax = 0, double jmin = 0, double jmax = 0, unsigned int nthreads = 1);
 
+    // Writes result (MINOS included), profile scans and stats
     void Write(const std::string& file) const;
 
 private:
     void SetFCN();
+    void SetFCN(ROOT::Fit::Fitter& fitter, const Objective& obj) const;
+    // Fitter on obj with the current configuration, starting at values
+    std::unique_ptr<ROOT::Fit::Fitter> MakeWorkerFitter(const Objective& obj, const DoubleVec& values) const;
+    void ParallelMinos();
+    std::pair<double, double> ScanRange(unsigned int ipar, double min, double max) const;
+    // FCN at the minimum with the given parameters fixed at each point, nthreads at a time
+    DoubleVec Profile(const std::vector<unsigned int>& pars, const std::vector<DoubleVec>& points,
+                      unsigned int nthreads) const;
+    std::vector<DoubleVec> SampleStarts(unsigned int nstarts, unsigned long seed, StartMode mode) const;
+    void PrintMultiStart() const;
+    void PrintBootstrap() const;
+    void PrintToys() const;
+    // Fits nreplicas spectra on the data bins, starting from the last minimum, nthreads at a time
+    // Replica r is filled by sample from a stream seeded by (seed, r); collect is called from the fitting thread
+    void FitReplicas(unsigned int nreplicas, unsigned int nthreads, unsigned long seed, const Sampler& sample,
+                     const Collector& collect) const;
+    // Counts of gaussians and voigts in the bins of obj at pars (model of obj is updated)
+    std::map<std::string, double> ComponentCounts(const Objective& obj, const DoubleVec& pars) const;
+    DoubleVec ConfigSignature() const;
+    // Seeds the configuration from the last minimum; returns the previous step sizes
+    DoubleVec WarmStart();
     void ParametersAtLimit();
     bool CompareDoubles(double a, double b, double tol = 0.0001) const;
 };
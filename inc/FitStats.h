@@ -0,0 +1,52 @@
+#ifndef FitStats_h
+#define FitStats_h
+
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace Fitters
+{
+// Counters of the evaluations of an Objective, only filled when enabled (Objective::SetUseStats)
+// Times in seconds
+struct FitStats
+{
+    unsigned long fNFCN {};          // FCN evaluations
+    unsigned long fNGradient {};     // analytic gradient evaluations
+    unsigned long fNConvolutions {}; // convolutions computed, not found in cache
+    double fTotalTime {};            // in FCN and gradient
+    double fModelTime {};            // evaluating the model on the bins (with the FCN terms when parallel)
+    double fConvTime {};             // in Model::TriggerConvolution
+    // Value evaluation of each component, by label. Not measured when the objective runs in parallel
+    std::vector<std::string> fComponents {};
+    std::vector<double> fComponentTime {};
+
+    void Reset();
+    void Print(std::ostream& out = std::cout) const;
+};
+
+// Adds the time spent in its scope to target. No clock is read without target
+class ScopedTimer
+{
+private:
+    double* fTarget {};
+    std::chrono::steady_clock::time_point fStart {};
+
+public:
+    explicit ScopedTimer(double* target) : fTarget(target)
+    {
+        if(fTarget)
+            fStart = std::chrono::steady_clock::now();
+    }
+    ~ScopedTimer()
+    {
+        if(fTarget)
+            *fTarget += std::chrono::duration<double>(std::chrono::steady_clock::now() - fStart).count();
+    }
+    ScopedTimer(const ScopedTimer&) = delete;
+    ScopedTimer& operator=(const ScopedTimer&) = delete;
+};
+} // namespace Fitters
+
+#endif // !FitStats_h
@@ -0,0 +1,55 @@
+#ifndef FitThreadPool_h
+#define FitThreadPool_h
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace Fitters
+{
+// Fixed set of workers that stay alive between jobs
+// A job is a number of tasks: each task index is run exactly once, by any worker or by the caller
+// Results that must not depend on the number of threads are obtained by writing one slot per task
+// and reducing the slots in order after Run returns
+class ThreadPool
+{
+private:
+    std::vector<std::thread> fWorkers {};
+    std::mutex fMutex {};
+    std::condition_variable fWake {};
+    std::condition_variable fDone {};
+    // Only one job at a time
+    std::mutex fRunMutex {};
+    // State of current job
+    const std::function<void(std::size_t)>* fTask {};
+    std::size_t fNTasks {};
+    std::atomic<std::size_t> fNext {};
+    unsigned int fPending {};
+    unsigned long fGeneration {};
+    std::exception_ptr fError {};
+    bool fStop {};
+
+public:
+    // Total number of threads, counting the caller of Run
+    explicit ThreadPool(unsigned int nthreads);
+    ~ThreadPool();
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    unsigned int GetNThreads() const { return fWorkers.size() + 1; }
+    // Runs task(i) for i in [0, ntasks) and returns once all of them finished
+    // The first exception thrown by a task is rethrown here. Tasks must not call Run on the same pool
+    void Run(std::size_t ntasks, const std::function<void(std::size_t)>& task);
+
+private:
+    void Work();
+    void Drain();
+};
+} // namespace Fitters
+
+#endif // !FitThreadPool_h
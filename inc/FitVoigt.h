@@ -0,0 +1,49 @@
+#ifndef FitVoigt_h
+#define FitVoigt_h
+
+#include <array>
+#include <complex>
+
+namespace Fitters
+{
+// Voigt profile with the same convention as TMath::Voigt(x, sigma, lg):
+// normalized convolution of a Gaussian of width sigma and a Lorentzian of FWHM lg
+namespace Voigt
+{
+// Accuracy tiers of the profile
+// kReference: TMath::Voigt, as used so far (Humlicek, ~1e-4 relative)
+// kFast: Weideman's approximation below, vectorized in batch. Relative to an exact profile it is better than 1e-7
+// over the whole range of interest, so it departs from kReference by TMath's own error (< 1e-4)
+enum class Mode
+{
+    kReference,
+    kFast
+};
+
+constexpr int kWeidemanN {32};
+// Scale L and coefficients a_1 ... a_N of Weideman's approximation, computed once
+double WeidemanL();
+const std::array<double, kWeidemanN>& WeidemanCoefficients();
+
+// Faddeeva function w(z) = exp(-z^2) erfc(-iz), Weideman rational approximation (N = 32)
+// Valid in the upper half plane Im(z) >= 0, which is the only one needed by the profile
+std::complex<double> Faddeeva(std::complex<double> z);
+
+// Value of the profile in the given mode
+double Eval(double x, double sigma, double lg, Mode mode = Mode::kReference);
+// Value of the profile with Weideman's approximation
+double Fast(double x, double sigma, double lg);
+
+// Value and derivatives of the profile with respect to x, sigma and lg
+void Derivatives(double x, double sigma, double lg, double& value, double& dx, double& dsigma, double& dlg);
+// Same from TMath::Voigt (central differences, forward at the boundary of sigma and lg), consistent with
+// Eval in reference mode
+void DerivativesReference(double x, double sigma, double lg, double& value, double& dx, double& dsigma, double& dlg);
+
+// Integral of the profile over [a, b] (the area is 1 over the whole line). Gaussian CDF averaged over the
+// Lorentzian, by Gauss-Legendre on panels refined around the edges: ~1e-9 absolute, no allocation
+double Integral(double a, double b, double sigma, double lg);
+} // namespace Voigt
+} // namespace Fitters
+
+#endif // !FitVoigt_h
@@ -1,25 +1,26 @@
 #include "AngFitter.h"
 
 #include "TCanvas.h"
-#include "TF1.h"
 #include "TFile.h"
 #include "TFitResult.h"
 #include "TGraph.h"
+#include "TGraphAsymmErrors.h"
 #include "TGraphErrors.h"
 #include "THStack.h"
 #include "TLegend.h"
 #include "TMath.h"
 #include "TMultiGraph.h"
+#include "TROOT.h"
 #include "TRegexp.h"
 #include "TString.h"
 
-#include "Math/IntegratorOptions.h"
-
 #include "AngGlobals.h"
 #include "FitData.h"
 #include "FitModel.h"
 #include "FitPlotter.h"
 #include "FitRunner.h"
+#include "FitThreadPool.h"
+#include "FitVoigt.h"
 #include "PhysColors.h"
 
 #include <algorithm>
@@ -28,6 +29,7 @@
 #include <iostream>
 #include <memory>
 #include <set>
+#include <sstream>
 #include <stdexcept>
 #include <string>
 #include <utility>
@@ -84,6 +86,10 @@ void Angular::Fitter::AddModels()
             vps.push_back(*hps[i]);
         fModels.push_back(Fitters::Model {ngauss, nvoigt, vps, (bool)ncte});
     }
+    // One cache of convolutions for all intervals
+    fConvCache = std::make_shared<Fitters::ConvCache>();
+    for(auto& model : fModels)
+        model.SetConvCache(fConvCache);
     // Print
     std::cout << BOLDGREEN << "-> NGauss : " << ngauss << RESET << '\n';
     std::cout << BOLDGREEN << "-> NVoigt : " << nvoigt << RESET << '\n';
@@ -221,18 +227,71 @@ void Angular::Fitter::ConfigRunner(int iv, Fitters::Runner& runner)
 
 void Angular::Fitter::Run(bool print)
 {
-    for(int i = 0; i < fData.size(); i++)
+    auto niv {fData.size()};
+    // Runners are built serially: models are cloned into them, which copies ROOT objects
+    std::vector<std::unique_ptr<Fitters::Runner>> runners {};
+    for(int i = 0; i < niv; i++)
     {
         // Initialize runnner
-        Fitters::Runner runner {fData[i], fModels[i]};
+        auto& runner {*runners.emplace_back(std::make_unique<Fitters::Runner>(fData[i], fModels[i]))};
         // Pass integral opts to fitter
         runner.GetObjective().SetUseDivisions(fUseDivisions);
         runner.GetObjective().SetUseIntegral(fUseIntegral);
+        runner.GetObjective().SetUseBinAverage(fUseBinAverage);
+        runner.SetUseLikelihood(fUseLikelihood);
         // Config it
         ConfigRunner(i, runner);
-        // Fit!
-        runner.Fit(print, Angular::GetUseHessErrors());
+    }
+    // Fit! Each runner owns its model and objective; only the cache of convolutions is shared, and it is locked
+    // Output of each interval is buffered and printed in order once all of them are done
+    auto nthreads {std::max(1u, std::min<unsigned int>(fNThreads, niv))};
+    std::vector<std::ostringstream> outs(niv);
+    if(nthreads > 1)
+    {
+        ROOT::EnableThreadSafety();
+        for(int i = 0; i < niv; i++)
+        {
+            runners[i]->SetOutput(outs[i]);
+            // Minuit would print straight to stdout, interleaved: the summary of each fit goes to its buffer
+            runners[i]->GetFitter().Config().MinimizerOptions().SetPrintLevel(0);
+        }
+    }
+    Fitters::ThreadPool pool {nthreads};
+    if(!fChainIntervals)
+        pool.Run(niv, [&](std::size_t i) { runners[i]->Fit(print, Angular::GetUseHessErrors()); });
+    else
+    {
+        // Contiguous blocks of intervals, one per thread, fitted in order: each interval is seeded from the last
+        // converged one of its block. The first one of each block starts from the global fit
+        pool.Run(nthreads,
+                 [&](std::size_t b)
+                 {
+                     int last {-1};
+                     for(std::size_t i = b * niv / nthreads; i < (b + 1) * niv / nthreads; i++)
+                     {
+                         if(last >= 0)
+                         {
+                             std::ostream& out {(nthreads > 1) ? outs[i] : std::cout};
+                             SeedFromInterval(i, last, *runners[i], runners[last]->GetFitResult().Parameters(),
+                                              print ? &out : nullptr);
+                         }
+                         if(runners[i]->Fit(print, Angular::GetUseHessErrors()))
+                             last = i;
+                     }
+                 });
+    }
+    for(int i = 0; i < niv; i++)
+    {
+        auto& runner {*runners[i]};
+        std::cout << outs[i].str();
+        runner.SetOutput(std::cout);
         fRes.push_back(runner.GetFitResult());
+        // Uncertainties of amplitudes and counts from resampled data
+        if(fNBoot > 0)
+        {
+            runner.Bootstrap(fNBoot, fNThreadsBoot, fBootSeed + i, Fitters::Runner::ResampleMode::kPoisson, print);
+            fBoot.push_back(runner.GetBootstrapStats());
+        }
     }
     // Implicitly compute integrals
     ComputeIntegrals();
@@ -240,6 +299,35 @@ void Angular::Fitter::Run(bool print)
     FillResHistos();
 }
 
+void Angular::Fitter::SeedFromInterval(unsigned int iv, unsigned int from, Fitters::Runner& runner,
+                                       const std::vector<double>& pars, std::ostream* out) const
+{
+    // Amplitudes follow the number of counts in each interval
+    auto integral {fData[iv].IntegralBins(0, fData[iv].GetSize() - 1)};
+    auto integralFrom {fData[from].IntegralBins(0, fData[from].GetSize() - 1)};
+    double ratio {(integral > 0 && integralFrom > 0) ? integral / integralFrom : 1};
+    auto& config {runner.GetFitter().Config()};
+    for(unsigned int p = 0; p < pars.size() && p < config.ParamsSettings().size(); p++)
+    {
+        auto& par {config.ParSettings(p)};
+        // Fixed ones and manual initial values are kept
+        if(par.IsFixed() || fManualPars.count(fParNames[p]))
+            continue;
+        double value {pars[p]};
+        if(fParNames[p].find("_Amp") != std::string::npos)
+            value *= ratio;
+        // Within the ranges of free mean, sigma and gamma, set from the global fit of this interval
+        if(par.HasLowerLimit())
+            value = std::max(value, par.LowerLimit());
+        if(par.HasUpperLimit())
+            value = std::min(value, par.UpperLimit());
+        par.SetValue(value);
+    }
+    if(out)
+        *out << BOLDGREEN << "Angular::Fitter::SeedFromInterval(): interval " << iv << " seeded from " << from
+             << " with amplitude ratio " << ratio << RESET << '\n';
+}
+
 void Angular::Fitter::FillResHistos()
 {
     fResIvs.clear();
@@ -304,6 +392,7 @@ void Angular::Fitter::ComputeIntegrals(int nsigma)
 {
     // Clear vectors
     fIgCounts.clear();
+    fIgCountsErr.clear();
     fSumCounts.clear();
     // Run for each interval
     for(int i = 0; i < fData.size(); i++)
@@ -312,65 +401,67 @@ void Angular::Fitter::ComputeIntegrals(int nsigma)
 
 void Angular::Fitter::DoCounts(unsigned int iv, int nsigma)
 {
-    // Unpack parameters
-    auto pack {fModels[iv].UnpackParameters(fRes[iv].GetParams())};
-    auto gaus = pack[0];
-    auto voigt = pack[1];
-    // Range of numerical integration
+    const auto& model {fModels[iv]};
+    const auto* params {fRes[iv].GetParams()};
+    // Range of integration; yields in counts per bin
     auto xmin {fData[iv].GetXLow()};
     auto xmax {fData[iv].GetXUp()};
-    // And integrate!
-    // 1-> Gauss
-    int idx {};
-    for(const auto& pars : gaus)
-    {
-        std::string key {"g" + std::to_string(idx)};
-        auto* f {new TF1 {"gaus", "gaus", xmin, xmax}};
-        f->SetParameters(pars.data());
-        fIgCounts[key].push_back(f->Integral(xmin, xmax) / fData[iv].GetBinWidth());
-        // By sum
-        CountsBySum(key, iv, nsigma, f);
-        delete f;
-        idx++;
-    }
-    // 2-> Voigt
-    idx = 0;
-    // Issue with Voigts: the default
-    // AdiptiveSingular integration algorithm always
-    // yields errors related with the tolerance
-    // Changing to Gauss provides the same results without warning
-    if(voigt.size())
-        ROOT::Math::IntegratorOneDimOptions::SetDefaultIntegrator("Gauss");
-    for(const auto& pars : voigt)
+    auto bw {fData[iv].GetBinWidth()};
+    // Yields in closed form (same integral as the counts of a bootstrap), with the gradient wrt the parameters of
+    // the peak for the covariance propagation
+    auto store {[&](const Fitters::Model::Component& comp, const std::vector<double>& grad)
+                {
+                    double var {};
+                    for(unsigned int i = 0; i < grad.size(); i++)
+                        for(unsigned int j = 0; j < grad.size(); j++)
+                            var += grad[i] * grad[j] * fRes[iv].CovMatrix(comp.fOffset + i, comp.fOffset + j);
+                    auto key {model.GetComponentLabel(comp)};
+                    fIgCounts[key].push_back(model.IntegralComponent(comp, params, xmin, xmax) / bw);
+                    fIgCountsErr[key].push_back(std::sqrt(std::max(var, 0.)));
+                }};
+    for(const auto& comp : model.GetComponents())
     {
-
-        std::string key {"v" + std::to_string(idx)};
-        auto f = new TF1("voigt", "[0] * TMath::Voigt(x - [1], [2], [3])", xmin, xmax);
-        f->SetParameters(pars.data());
-        fIgCounts[key].push_back(f->Integral(xmin, xmax) / fData[iv].GetBinWidth());
+        if(comp.fType != Fitters::Model::FuncType::kGauss && comp.fType != Fitters::Model::FuncType::kVoigt)
+            continue;
+        const double* pars {params + comp.fOffset};
+        auto amp {pars[0]};
+        auto mean {pars[1]};
+        auto sigma {pars[2]};
+        // 1-> Gauss: A sigma sqrt(pi / 2) [erf(ub) - erf(ua)], u = (x - mean) / (sqrt(2) sigma)
+        if(comp.fType == Fitters::Model::FuncType::kGauss)
+        {
+            double ua {(xmin - mean) / (M_SQRT2 * sigma)};
+            double ub {(xmax - mean) / (M_SQRT2 * sigma)};
+            double ea {std::exp(-ua * ua)};
+            double eb {std::exp(-ub * ub)};
+            double derf {std::erf(ub) - std::erf(ua)};
+            double shape {sigma * std::sqrt(M_PI / 2) * derf / bw};
+            store(comp, {shape, amp * (ea - eb) / bw,
+                         amp / bw * (std::sqrt(M_PI / 2) * derf - M_SQRT2 * (ub * eb - ua * ea))});
+        }
+        // 2-> Voigt: area of the normalized profile within the range (no elementary CDF, see Voigt::Integral)
+        else
+        {
+            auto lg {pars[3]};
+            auto area {[&](double s, double l) { return Fitters::Voigt::Integral(xmin - mean, xmax - mean, s, l); }};
+            // Widths by central differences; mean from the profile at the edges
+            double hs {1e-4 * sigma};
+            double hl {1e-4 * std::max(lg, 1e-6)};
+            double lgDown {std::max(lg - hl, 0.)};
+            double edges {Fitters::Voigt::Eval(xmin - mean, sigma, lg) - Fitters::Voigt::Eval(xmax - mean, sigma, lg)};
+            store(comp, {area(sigma, lg) / bw, amp * edges / bw,
+                         amp * (area(sigma + hs, lg) - area(sigma - hs, lg)) / (2 * hs * bw),
+                         amp * (area(sigma, lg + hl) - area(sigma, lgDown)) / ((lg + hl - lgDown) * bw)});
+        }
         // By sum
-        CountsBySum(key, iv, nsigma, f);
-        delete f;
-        idx++;
+        CountsBySum(model.GetComponentLabel(comp), iv, nsigma, mean, sigma);
     }
 }
 
-void Angular::Fitter::CountsBySum(const std::string& key, unsigned int iv, int nsigma, TF1* f)
+void Angular::Fitter::CountsBySum(const std::string& key, unsigned int iv, int nsigma, double mean, double sigma)
 {
-    // Create a histogram from the interval data to sum counts
-    int nbins {static_cast<int>((fData[iv].GetXUp() - fData[iv].GetXLow()) / fData[iv].GetBinWidth())};
-    auto* h {new TH1D("htemp", "h for sum", nbins, fData[iv].GetXLow(), fData[iv].GetXUp())};
-    for(int histbin = 1; histbin <= h->GetNbinsX(); histbin++)
-    {
-        auto x {h->GetXaxis()->GetBinCenter(histbin)};
-        // auto y {f->Eval(x)};
-        // WARNING: Contents are filled from the raw data, not from the evaluation of the fitted function
-        // because in that case of course there is a match!!
-        // Must convert to inner binning of each data element
-        auto inbin {fData[iv].GetBin(x)};
-        auto y {fData[iv].GetY(inbin)};
-        h->SetBinContent(histbin, y);
-    }
+    // WARNING: Counts are summed from the raw data, not from the evaluation of the fitted function
+    // because in that case of course there is a match!!
     // Set scale according to nsigma
     double scale {};
     if(nsigma == 1)
@@ -379,19 +470,13 @@ void Angular::Fitter::CountsBySum(const std::string& key, unsigned int iv, int n
         scale = 0.95;
     else
         throw std::runtime_error("Angular::Fitter::CountsBySum(): no nsigma correction factor implemented");
-    // And do integral
-    auto mean {f->GetParameter(1)};
-    auto sigma {f->GetParameter(2)};
     // Get intervals of integration, dependent on nsigma around mean
     double low {mean - nsigma * sigma};
-    auto binLow {h->FindBin(low)};
     double up {mean + nsigma * sigma};
-    auto binUp {h->FindBin(up)};
-    // Integral(bin1, bin2) just sums bin contents
-    auto integral {h->Integral(binLow, binUp)};
+    // Sum of bin contents from prefix sums of data
+    auto integral {fData[iv].Integral(low, up)};
     // Scale to full data
     fSumCounts[key].push_back(integral / scale);
-    delete h;
 }
 
 Angular::Fitter::CountsIv Angular::Fitter::GetIgCountsFor(const std::string& peak) const
@@ -402,6 +487,14 @@ Angular::Fitter::CountsIv Angular::Fitter::GetIgCountsFor(const std::string& pea
         throw std::invalid_argument("Fitter::GetIgCountsFor(): received not listed peak");
 }
 
+Angular::Fitter::CountsIv Angular::Fitter::GetIgCountsErrorsFor(const std::string& peak) const
+{
+    if(fIgCountsErr.count(peak))
+        return fIgCountsErr.at(peak);
+    else
+        throw std::invalid_argument("Fitter::GetIgCountsErrorsFor(): received not listed peak");
+}
+
 TGraphErrors* Angular::Fitter::GetIgCountsGraph(const std::string& peak) const
 {
     if(!fIgCounts.count(peak))
@@ -414,7 +507,11 @@ TGraphErrors* Angular::Fitter::GetIgCountsGraph(const std::string& peak) const
         if(fIvs)
             xlabel = fIvs->GetCenter(iv);
         g->SetPoint(iv, xlabel, counts[iv]);
-        g->SetPointError(iv, 0, TMath::Sqrt(counts[iv]));
+        // Uncertainty propagated from the fit covariance, counting estimate if not available
+        double err {};
+        if(fIgCountsErr.count(peak) && iv < fIgCountsErr.at(peak).size())
+            err = fIgCountsErr.at(peak)[iv];
+        g->SetPointError(iv, 0, (err > 0) ? err : TMath::Sqrt(counts[iv]));
     }
     // Style
     g->SetLineWidth(2);
@@ -449,6 +546,29 @@ TGraphErrors* Angular::Fitter::GetSumCountsGraph(const std::string& peak) const
     return g;
 }
 
+TGraphAsymmErrors* Angular::Fitter::GetBootCountsGraph(const std::string& peak, double cl) const
+{
+    if(fBoot.empty())
+        throw std::runtime_error("Fitter::GetBootCountsGraph(): no bootstrap, call SetBootstrap() before Run()");
+    auto* g {new TGraphAsymmErrors};
+    for(int iv = 0; iv < fBoot.size(); iv++)
+    {
+        const auto& boot {fBoot[iv]};
+        if(!boot.fNominalCounts.count(peak))
+            throw std::runtime_error("Fitter::GetBootCountsGraph(): could not find peak " + peak);
+        double xlabel {static_cast<double>(iv)};
+        if(fIvs)
+            xlabel = fIvs->GetCenter(iv);
+        auto counts {boot.fNominalCounts.at(peak)};
+        auto [low, up] {boot.CountsInterval(peak, cl)};
+        g->SetPoint(iv, xlabel, counts);
+        g->SetPointError(iv, 0, 0, std::max(counts - low, 0.), std::max(up - counts, 0.));
+    }
+    // Style
+    g->SetLineWidth(2);
+    return g;
+}
+
 TCanvas* Angular::Fitter::DrawCounts(bool both, const TString& title)
 {
     static int cCountsIdx {};
@@ -532,6 +652,8 @@ void Angular::Fitter::Read(const std::string& file)
 void Angular::Fitter::Print() const
 {
     std::cout << BOLDYELLOW << "···· Angular::Fitter settings ····" << '\n';
+    std::cout << "  UseBinAverage  ? " << std::boolalpha << fUseBinAverage << '\n';
+    std::cout << "  UseLikelihood  ? " << std::boolalpha << fUseLikelihood << '\n';
     std::cout << "  AllowFreeMean  ? " << std::boolalpha << fAllowFreeMean << '\n';
     std::cout << "  FreeMeanRange  : " << fFreeMeanRange << '\n';
     for(const auto& state : fWhichFreeMean)
@@ -545,6 +667,7 @@ void Angular::Fitter::Print() const
     for(const auto& state : fWhichFreeGamma)
         std::cout << "    For " << state << '\n';
     std::cout << "  Ignore PS      ? " << std::boolalpha << fIgnorePS << '\n';
+    std::cout << "  ChainIntervals ? " << std::boolalpha << fChainIntervals << '\n';
     std::cout << "  ManualRange    :  [" << fManualRange.first << ", " << fManualRange.second << "]" << '\n';
     std::cout << "······························" << RESET << '\n';
 }
@@ -2,18 +2,21 @@
 
 #include "ROOT/RDF/HistoModels.hxx"
 
+#include "RVersion.h"
 #include "TCanvas.h"
 #include "TF1.h"
 #include "TFile.h"
 #include "TH1.h"
 #include "THStack.h"
 #include "TMath.h"
+#include "TROOT.h"
 #include "TString.h"
 #include "TVirtualPad.h"
 
 #include "AngGlobals.h"
 #include "FitUtils.h"
 
+#include <algorithm>
 #include <memory>
 #include <mutex>
 #include <set>
@@ -64,38 +67,42 @@ double Angular::Intervals::ComputeSolidAngle(double min, double max)
     return TMath::TwoPi() * (TMath::Cos(min * TMath::DegToRad()) - TMath::Cos(max * TMath::DegToRad()));
 }
 
+int Angular::Intervals::FindInterval(double thetaCM) const
+{
+    if(fRanges.empty() || !(fRanges.front().first <= thetaCM && thetaCM < fRanges.back().second))
+        return -1;
+    // Uniform steps: direct guess, checking the neighbours for rounding of the edges
+    int n {static_cast<int>(fRanges.size())};
+    double step {(fRanges.back().second - fRanges.front().first) / n};
+    int guess {std::min(static_cast<int>((thetaCM - fRanges.front().first) / step), n - 1)};
+    for(int i = std::max(guess - 1, 0); i <= std::min(guess + 1, n - 1); i++)
+        if(fRanges[i].first <= thetaCM && thetaCM < fRanges[i].second)
+            return i;
+    // Otherwise binary search on the lower edges
+    auto it {std::upper_bound(fRanges.begin(), fRanges.end(), thetaCM,
+                              [](double x, const std::pair<double, double>& range) { return x < range.first; })};
+    if(it == fRanges.begin())
+        return -1;
+    --it;
+    return (thetaCM < it->second) ? static_cast<int>(it - fRanges.begin()) : -1;
+}
+
 void Angular::Intervals::Fill(double thetaCM, double Ex)
 {
-    for(int i = 0; i < fRanges.size(); i++)
-    {
-        auto min {fRanges[i].first};
-        auto max {fRanges[i].second};
-        if(min <= thetaCM && thetaCM < max)
-        {
-            {
-                std::lock_guard<std::mutex> lock {fMutex};
-                fHs[i]->Fill(Ex);
-            }
-            break;
-        }
-    }
+    auto i {FindInterval(thetaCM)};
+    if(i < 0)
+        return;
+    std::lock_guard<std::mutex> lock {fMutex};
+    fHs[i]->Fill(Ex);
 }
 
 void Angular::Intervals::FillPS(int idx, double thetaCM, double Ex, double weight)
 {
-    for(int i = 0; i < fRanges.size(); i++)
-    {
-        auto min {fRanges[i].first};
-        auto max {fRanges[i].second};
-        if(min <= thetaCM && thetaCM < max)
-        {
-            {
-                std::lock_guard<std::mutex> lock {fMutex};
-                fHsPS[idx][i]->Fill(Ex, weight);
-            }
-            break;
-        }
-    }
+    auto i {FindInterval(thetaCM)};
+    if(i < 0)
+        return;
+    std::lock_guard<std::mutex> lock {fMutex};
+    fHsPS[idx][i]->Fill(Ex, weight);
 }
 
 void Angular::Intervals::TreatPS(int nsmooth, double scale, const std::set<int>& which)
@@ -242,3 +249,58 @@ std::vector<double> Angular::Intervals::GetCenters() const
         ret.push_back(GetCenter(i));
     return ret;
 }
+
+Angular::IntervalsFiller::IntervalsFiller(Intervals& ivs, int ps, unsigned int nslots) : fIvs(&ivs), fPS(ps)
+{
+    if(fPS >= static_cast<int>(ivs.GetHistosPS().size()))
+        throw std::runtime_error("IntervalsFiller::IntervalsFiller(): no phase space " + std::to_string(fPS) +
+                                 " in Intervals");
+    fTargets = (fPS < 0) ? ivs.GetHistos() : ivs.GetHistosPS()[fPS];
+    if(nslots == 0)
+    {
+        // Renamed in ROOT 6.22
+#if ROOT_VERSION_CODE >= ROOT_VERSION(6, 22, 0)
+        nslots = ROOT::IsImplicitMTEnabled() ? ROOT::GetThreadPoolSize() : 1;
+#else
+        nslots = ROOT::IsImplicitMTEnabled() ? ROOT::GetImplicitMTPoolSize() : 1;
+#endif
+    }
+    // Shards are empty clones, built here and not in the workers (cloning is not thread-safe)
+    fShards.resize(nslots);
+    for(auto& shard : fShards)
+    {
+        for(auto* h : fTargets)
+        {
+            auto* clone {static_cast<TH1D*>(h->Clone())};
+            clone->SetDirectory(nullptr);
+            clone->Reset();
+            shard.emplace_back(clone);
+        }
+    }
+}
+
+void Angular::IntervalsFiller::Merge()
+{
+    for(auto& shard : fShards)
+    {
+        for(int i = 0; i < shard.size(); i++)
+        {
+            if(shard[i]->GetEntries() > 0)
+                fTargets[i]->Add(shard[i].get());
+            shard[i]->Reset();
+        }
+    }
+}
+
+std::shared_ptr<Angular::Intervals> Angular::IntervalsFiller::GetResultPtr() const
+{
+    // Non-owning: the Intervals belong to the caller
+    return std::shared_ptr<Intervals> {std::shared_ptr<Intervals> {}, fIvs};
+}
+
+void Angular::IntervalsFiller::InitTask(TTreeReader*, unsigned int slot)
+{
+    if(slot >= fShards.size())
+        throw std::runtime_error("IntervalsFiller::InitTask(): slot " + std::to_string(slot) +
+                                 " out of range, built with " + std::to_string(fShards.size()) + " slots");
+}
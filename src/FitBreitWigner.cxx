@@ -0,0 +1,228 @@
+#include "FitBreitWigner.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cmath>
+#include <complex>
+#include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <tuple>
+#include <vector>
+
+namespace
+{
+// Outgoing wave H+ = G + iF and its derivative at rho, up to a constant phase, from the asymptotic expansion
+// of Abramowitz & Stegun 14.5. Returns false if the series does not converge at this rho
+bool AsymptoticH(int l, double eta, double rho, std::complex<double>& h, std::complex<double>& dh)
+{
+    double ll {static_cast<double>(l * (l + 1))};
+    double f {1}, g {}, fs {}, gs {1 - eta / rho};
+    double fk {1}, gk {}, fsk {}, gsk {gs};
+    for(int k = 0; k < 200; k++)
+    {
+        double a {(2 * k + 1) * eta / ((2 * k + 2) * rho)};
+        double b {(ll - k * (k + 1) + eta * eta) / ((2 * k + 2) * rho)};
+        double fk1 {a * fk - b * gk};
+        double gk1 {a * gk + b * fk};
+        double fsk1 {a * fsk - b * gsk - fk1 / rho};
+        double gsk1 {a * gsk + b * fsk - gk1 / rho};
+        double term {std::abs(fk1) + std::abs(gk1) + std::abs(fsk1) + std::abs(gsk1)};
+        // Asymptotic series: stop if terms start growing
+        if(k > 0 && term > std::abs(fk) + std::abs(gk) + std::abs(fsk) + std::abs(gsk))
+            return false;
+        f += fk1;
+        g += gk1;
+        fs += fsk1;
+        gs += gsk1;
+        fk = fk1;
+        gk = gk1;
+        fsk = fsk1;
+        gsk = gsk1;
+        if(term < 1e-15)
+        {
+            double theta {rho - eta * std::log(2 * rho) - l * M_PI / 2};
+            auto phase {std::polar(1., theta)};
+            h = std::complex<double> {f, g} * phase;
+            dh = std::complex<double> {fs, gs} * phase;
+            return true;
+        }
+    }
+    return false;
+}
+} // namespace
+
+double Fitters::BWL::CoulombLogPenetrability(int l, double eta, double rho)
+{
+    if(l < 0 || !(rho > 0))
+        throw std::runtime_error("BWL::CoulombLogPenetrability(): l must be >= 0 and rho > 0");
+    // Start where the asymptotic expansion converges
+    double r {std::max(rho, 20. + 2 * eta + l)};
+    std::complex<double> u {}, du {};
+    while(!AsymptoticH(l, eta, r, u, du))
+    {
+        r *= 2;
+        if(r > 1e6)
+            throw std::runtime_error("BWL::CoulombLogPenetrability(): no convergence of asymptotic expansion");
+    }
+    // Inwards RK4 on u'' = (l(l+1)/rho^2 + 2 eta/rho - 1) u, with steps a fraction of the local wavelength or
+    // decay length. Below the barrier H+ grows exponentially inwards: rescale and keep track of the log
+    double ll {static_cast<double>(l * (l + 1))};
+    auto V {[&](double x) { return ll / (x * x) + 2 * eta / x - 1; }};
+    double logScale {};
+    while(r > rho)
+    {
+        double h {std::min(0.05, 0.03 / std::sqrt(std::abs(V(r)) + 1e-12))};
+        h = -std::min(h, r - rho);
+        auto k1u {du};
+        auto k1v {V(r) * u};
+        auto k2u {du + 0.5 * h * k1v};
+        auto k2v {V(r + 0.5 * h) * (u + 0.5 * h * k1u)};
+        auto k3u {du + 0.5 * h * k2v};
+        auto k3v {V(r + 0.5 * h) * (u + 0.5 * h * k2u)};
+        auto k4u {du + h * k3v};
+        auto k4v {V(r + h) * (u + h * k3u)};
+        u += h / 6 * (k1u + 2. * k2u + 2. * k3u + k4u);
+        du += h / 6 * (k1v + 2. * k2v + 2. * k3v + k4v);
+        r += h;
+        if(std::abs(u) > 1e150)
+        {
+            u *= 1e-150;
+            du *= 1e-150;
+            logScale += 150 * M_LN10;
+        }
+    }
+    return std::log(rho) - 2 * (std::log(std::abs(u)) + logScale);
+}
+
+Fitters::BWL::CoulombTable::CoulombTable(int l, double z1z2, double mu, double R, double emin, double emax,
+                                         int npoints)
+{
+    if(!(emax > 0) || !(emax > emin) || npoints < 0 || (npoints > 0 && npoints < 4))
+        throw std::runtime_error("BWL::CoulombTable::CoulombTable(): invalid energy grid");
+    auto logP {[&](double e)
+               {
+                   double rho {std::sqrt(2 * mu * e) / kHbarC * R};
+                   double eta {z1z2 * kAlpha * std::sqrt(mu / (2 * e))};
+                   return CoulombLogPenetrability(l, eta, rho);
+               }};
+    if(!(emin > 0))
+    {
+        // Down to where P_l underflows (or to 1e-12 MeV, then energies below throw)
+        const double logMin {std::log(std::numeric_limits<double>::denorm_min())};
+        emin = emax;
+        double value {};
+        do
+        {
+            emin /= 2;
+            value = logP(emin);
+        } while(value > logMin && emin > 1e-12);
+        fFromThreshold = value <= logMin;
+    }
+    if(npoints == 0)
+        npoints = std::max(16, static_cast<int>(std::ceil(120 * std::log10(emax / emin)))) + 1;
+    fLogEMin = std::log(emin);
+    fLogStep = (std::log(emax) - fLogEMin) / (npoints - 1);
+    fLogP.resize(npoints);
+    for(int i = 0; i < npoints; i++)
+        fLogP[i] = logP(std::exp(fLogEMin + i * fLogStep));
+}
+
+double Fitters::BWL::CoulombTable::LogP(double e) const
+{
+    auto n {static_cast<long>(fLogP.size())};
+    double pos {(e > 0) ? (std::log(e) - fLogEMin) / fLogStep : -1};
+    // Within rounding of the ends
+    const double tol {1e-9};
+    if(pos < -tol && fFromThreshold)
+        return -std::numeric_limits<double>::infinity();
+    if(pos < -tol || pos > n - 1 + tol)
+        throw std::runtime_error("BWL::CoulombTable::LogP(): decay energy " + std::to_string(e) +
+                                 " MeV outside the tabulated range [" + std::to_string(GetEMin()) + ", " +
+                                 std::to_string(GetEMax()) + "] MeV");
+    pos = std::clamp(pos, 0., static_cast<double>(n - 1));
+    // Catmull-Rom on the logarithmic grid, one-sided tangents at the ends
+    auto i {std::min(static_cast<long>(pos), n - 2)};
+    double t {pos - i};
+    double y0 {fLogP[i]};
+    double y1 {fLogP[i + 1]};
+    double m0 {(i > 0) ? 0.5 * (y1 - fLogP[i - 1]) : y1 - y0};
+    double m1 {(i + 2 < n) ? 0.5 * (fLogP[i + 2] - y0) : y1 - y0};
+    double t2 {t * t};
+    double t3 {t2 * t};
+    return (2 * t3 - 3 * t2 + 1) * y0 + (t3 - 2 * t2 + t) * m0 + (-2 * t3 + 3 * t2) * y1 + (t3 - t2) * m1;
+}
+
+std::shared_ptr<const Fitters::BWL::CoulombTable>
+Fitters::BWL::CoulombTable::Get(int l, double z1z2, double mu, double R, double emin, double emax)
+{
+    static std::mutex mutex;
+    static std::map<std::tuple<int, double, double, double>, std::shared_ptr<const CoulombTable>> tables;
+    std::lock_guard<std::mutex> lock {mutex};
+    auto& table {tables[{l, z1z2, mu, R}]};
+    if(table && table->Covers(emin, emax))
+        return table;
+    // Wider than asked and than the previous table, so that small moves of the range reuse it
+    double hi {2 * emax};
+    double lo {(emin > 0) ? emin / 2 : 0};
+    if(table)
+    {
+        hi = std::max(hi, table->GetEMax());
+        lo = (lo > 0 && !table->IsFromThreshold()) ? std::min(lo, table->GetEMin()) : 0;
+    }
+    table = std::make_shared<const CoulombTable>(l, z1z2, mu, R, lo, hi);
+    return table;
+}
+
+void Fitters::BWL::Coulomb::Cover(double xmin, double xmax)
+{
+    // Nothing above threshold: never evaluated
+    if(!(xmax > fS))
+        return;
+    if(fTable && fTable->Covers(xmin - fS, xmax - fS))
+        return;
+    fTable = CoulombTable::Get(fL, fZ1Z2, fMu, fR, xmin - fS, xmax - fS);
+}
+
+double Fitters::BWL::Coulomb::Norm(double mean, double Gamma0) const
+{
+    if(!fTable)
+        throw std::runtime_error("BWL::Coulomb::Norm(): no penetrabilities tabulated, call Cover() (done by "
+                                 "Model::TriggerConvolution) first");
+    double logP {fTable->LogP(mean - fS)};
+    if(std::isinf(logP))
+        throw std::runtime_error("BWL::Coulomb::Norm(): resonance energy " + std::to_string(mean) +
+                                 " MeV at threshold or where the penetrability underflows");
+    return Gamma0 * std::exp(-logP);
+}
+
+Fitters::BWL::Custom::Custom(Function func) : fFunc(std::move(func))
+{
+    if(!fFunc)
+        throw std::runtime_error("BWL::Custom::Custom(): empty function");
+    static std::atomic<long> count {};
+    fId = ++count;
+}
+
+Fitters::BWL::Func Fitters::BWL::Make(int l, double s, double mu, double R, double z1z2)
+{
+    if(z1z2 > 0)
+    {
+        if(l < 0)
+            throw std::runtime_error("BWL::Make(): l must be >= 0, got " + std::to_string(l));
+        return Coulomb {l, s, mu, R, z1z2};
+    }
+    switch(l)
+    {
+    case 0: return Shape<0> {s, mu, R};
+    case 1: return Shape<1> {s, mu, R};
+    case 2: return Shape<2> {s, mu, R};
+    default:
+        throw std::runtime_error("BWL::Make(): currently only l = 0, 1, 2 are implemented for neutral channels. Use "
+                                 "z1z2 > 0 for Coulomb penetrabilities");
+    }
+}
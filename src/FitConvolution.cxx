@@ -0,0 +1,216 @@
+#include "FitConvolution.h"
+
+#include "PhysColors.h"
+
+#include <cmath>
+#include <complex>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <future>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+Fitters::ConvTable::ConvTable(double xmin, double xmax, std::vector<double> y) : fXMin(xmin), fY(std::move(y))
+{
+    if(fY.size() < 2)
+        throw std::runtime_error("ConvTable::ConvTable(): at least 2 points are needed");
+    fStep = (xmax - xmin) / (fY.size() - 1);
+}
+
+double Fitters::ConvTable::Eval(double x) const
+{
+    double pos {(x - fXMin) / fStep};
+    // Clamp to first and last segments
+    auto last {static_cast<long>(fY.size()) - 2};
+    auto i {static_cast<long>(pos)};
+    i = (pos < 0) ? 0 : ((i > last) ? last : i);
+    double t {pos - i};
+    return fY[i] + t * (fY[i + 1] - fY[i]);
+}
+
+void Fitters::ConvTable::EvalBatch(const double* x, std::size_t n, double amp, double* out) const
+{
+    for(std::size_t i = 0; i < n; i++)
+        out[i] += amp * Eval(x[i]);
+}
+
+void Fitters::Convolution::FFT(std::vector<std::complex<double>>& data, bool inverse)
+{
+    auto n {data.size()};
+    if(n == 0 || (n & (n - 1)) != 0)
+        throw std::runtime_error("Convolution::FFT(): size must be a power of 2");
+    // Bit reversal permutation
+    for(std::size_t i = 1, j = 0; i < n; i++)
+    {
+        auto bit {n >> 1};
+        for(; j & bit; bit >>= 1)
+            j ^= bit;
+        j ^= bit;
+        if(i < j)
+            std::swap(data[i], data[j]);
+    }
+    // Twiddles computed once: w[k] = exp(-+2 pi i k / n), k < n / 2
+    double sign {inverse ? 1. : -1.};
+    std::vector<std::complex<double>> w(n / 2);
+    for(std::size_t k = 0; k < n / 2; k++)
+        w[k] = std::polar(1., sign * 2 * M_PI * k / n);
+    // Butterflies
+    for(std::size_t len = 2; len <= n; len <<= 1)
+    {
+        auto half {len / 2};
+        auto stride {n / len};
+        for(std::size_t i = 0; i < n; i += len)
+        {
+            for(std::size_t k = 0; k < half; k++)
+            {
+                auto u {data[i + k]};
+                auto v {data[i + k + half] * w[k * stride]};
+                data[i + k] = u + v;
+                data[i + k + half] = u - v;
+            }
+        }
+    }
+    if(inverse)
+        for(auto& d : data)
+            d /= static_cast<double>(n);
+}
+
+std::shared_ptr<const Fitters::ConvTable> Fitters::Convolution::Gaussian(const Sampler& f, double sigma, double xmin,
+                                                                         double xmax, int npoints)
+{
+    if(npoints < 2 || !(xmax > xmin))
+        throw std::runtime_error("Convolution::Gaussian(): invalid range or number of points");
+    sigma = std::abs(sigma);
+    double step {(xmax - xmin) / (npoints - 1)};
+    // Padding: beyond 8 sigma the Gaussian is below 1e-14 of its maximum
+    auto pad {static_cast<std::size_t>(std::ceil(8 * sigma / step)) + 1};
+    std::size_t n {1};
+    while(n < npoints + 2 * pad)
+        n <<= 1;
+    if(n > (std::size_t {1} << 24))
+        throw std::runtime_error("Convolution::Gaussian(): sigma too large for the sampling step, grid would have " +
+                                 std::to_string(n) + " points");
+    // Sample f on [xmin - pad * step, xmax + pad * step]; the remaining points are zero
+    double x0 {xmin - pad * step};
+    std::size_t nsampled {npoints + 2 * pad};
+    std::vector<double> xs(nsampled);
+    for(std::size_t i = 0; i < nsampled; i++)
+        xs[i] = x0 + i * step;
+    std::vector<double> ys(nsampled);
+    f(xs.data(), nsampled, ys.data());
+    std::vector<std::complex<double>> data(n);
+    for(std::size_t i = 0; i < nsampled; i++)
+        data[i] = ys[i];
+    FFT(data, false);
+    // Fourier transform of the normalized Gaussian: exp(-2 pi^2 sigma^2 nu^2), with nu = k / (n * step)
+    double factor {-2 * M_PI * M_PI * sigma * sigma / (n * step * n * step)};
+    for(std::size_t k = 0; k < n; k++)
+    {
+        double kk {(k <= n / 2) ? static_cast<double>(k) : static_cast<double>(k) - n};
+        data[k] *= std::exp(factor * kk * kk);
+    }
+    FFT(data, true);
+    std::vector<double> y(npoints);
+    for(int i = 0; i < npoints; i++)
+        y[i] = data[pad + i].real();
+    return std::make_shared<const ConvTable>(xmin, xmax, std::move(y));
+}
+
+std::shared_ptr<const Fitters::ConvTable> Fitters::ConvCache::Get(const Key& key, const Builder& build)
+{
+    std::promise<std::shared_ptr<const ConvTable>> promise;
+    std::shared_future<std::shared_ptr<const ConvTable>> cached {};
+    unsigned long id {};
+    {
+        std::lock_guard<std::mutex> lock {fMutex};
+        auto it {fIndex.find(key)};
+        if(it != fIndex.end())
+        {
+            fHits++;
+            // Move to front
+            fEntries.splice(fEntries.begin(), fEntries, it->second);
+            cached = it->second->fTable;
+        }
+        else
+        {
+            fMisses++;
+            // Publish a pending entry, so that other threads asking for key wait for this build
+            id = fMisses;
+            fEntries.push_front({key, promise.get_future().share(), id});
+            fIndex[key] = fEntries.begin();
+            // Evict least recently used (waiters of a pending one hold its future)
+            if(fEntries.size() > fCapacity)
+            {
+                fIndex.erase(fEntries.back().fKey);
+                fEntries.pop_back();
+            }
+        }
+    }
+    // Outside the lock: waits if it is still being built by another thread
+    if(cached.valid())
+        return cached.get();
+    // Build without holding the lock
+    std::shared_ptr<const ConvTable> table {};
+    try
+    {
+        table = build();
+    }
+    catch(...)
+    {
+        // Drop the entry so that the next call retries, and pass the error to the waiters
+        {
+            std::lock_guard<std::mutex> lock {fMutex};
+            auto it {fIndex.find(key)};
+            if(it != fIndex.end() && it->second->fBuild == id)
+            {
+                fEntries.erase(it->second);
+                fIndex.erase(it);
+            }
+        }
+        promise.set_exception(std::current_exception());
+        throw;
+    }
+    promise.set_value(table);
+    return table;
+}
+
+void Fitters::ConvCache::Clear()
+{
+    std::lock_guard<std::mutex> lock {fMutex};
+    fEntries.clear();
+    fIndex.clear();
+}
+
+unsigned long Fitters::ConvCache::GetHits() const
+{
+    std::lock_guard<std::mutex> lock {fMutex};
+    return fHits;
+}
+
+unsigned long Fitters::ConvCache::GetMisses() const
+{
+    std::lock_guard<std::mutex> lock {fMutex};
+    return fMisses;
+}
+
+std::size_t Fitters::ConvCache::GetSize() const
+{
+    std::lock_guard<std::mutex> lock {fMutex};
+    return fEntries.size();
+}
+
+void Fitters::ConvCache::Print() const
+{
+    std::lock_guard<std::mutex> lock {fMutex};
+    std::cout << BOLDGREEN << "---- Fitters::ConvCache ----" << '\n';
+    std::cout << "-> Size     : " << fEntries.size() << " / " << fCapacity << '\n';
+    std::cout << "-> Hits     : " << fHits << '\n';
+    std::cout << "-> Misses   : " << fMisses << '\n';
+    std::cout << "------------------------------" << RESET << '\n';
+}
@@ -2,67 +2,281 @@
 
 #include "PhysColors.h"
 
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
 #include <cstdlib>
 #include <iostream>
+#include <memory>
+#include <mutex>
 #include <stdexcept>
+#include <vector>
 
-void Fitters::Data::Fill(const TH1D& h)
+Fitters::Data::Data(const TH1D& h, double xlow, double xup, bool withErrors) : fXLow(xlow), fXUp(xup)
 {
     // Before filling, check range
-    auto hmin {h.GetXaxis()->GetXmin()};
-    auto hmax {h.GetXaxis()->GetXmax()};
+    const auto* axis {h.GetXaxis()};
+    auto hmin {axis->GetXmin()};
+    auto hmax {axis->GetXmax()};
     if(fXLow < hmin || hmax < fXUp)
     {
-        std::cout << BOLDRED << "Fitters::Data::Fill(): given range is wider than histogram one!" << '\n';
+        std::cout << BOLDRED << "Fitters::Data::Data(): given range is wider than histogram one!" << '\n';
         std::cout << "  defaulting to hist range of: [" << hmin << ", " << hmax << "]" << RESET << '\n';
         fXLow = hmin;
         fXUp = hmax;
     }
-    for(int bin = 1; bin <= h.GetNbinsX(); bin++)
+    // Contiguous bins with centre in range
+    int first {1};
+    while(first <= h.GetNbinsX() && axis->GetBinCenter(first) < fXLow)
+        first++;
+    int last {h.GetNbinsX()};
+    while(last >= first && axis->GetBinCenter(last) > fXUp)
+        last--;
+    fSize = (last >= first) ? last - first + 1 : 0;
+    if(fSize < 2)
+        throw std::runtime_error("Data::Data(): size of data is < 2, a required minimum!");
+    // Contents are copied once (index 0 is the underflow): derived arrays stay consistent with them even if the
+    // histogram is refilled, scaled or destroyed afterwards
+    auto y {std::make_shared<std::vector<double>>(h.GetArray() + first, h.GetArray() + first + fSize)};
+    fY = y->data();
+    fYStore = y;
+    if(withErrors)
+    {
+        // Sumw2 stores variances: errors computed once
+        auto errors {std::make_shared<std::vector<double>>(fSize)};
+        for(unsigned int i = 0; i < fSize; i++)
+            (*errors)[i] = h.GetBinError(first + i);
+        fErrors = errors->data();
+        fErrorsStore = errors;
+    }
+    if(axis->GetXbins()->GetSize() == 0)
+    {
+        // Fixed bins: nothing to store
+        fEdge0 = axis->GetBinLowEdge(first);
+        fBinWidth = axis->GetBinWidth(first);
+        fUniform = true;
+        fLazyX = std::make_shared<LazyArray>();
+        fLazyEdges = std::make_shared<LazyArray>();
+    }
+    else
     {
-        auto x {h.GetXaxis()->GetBinCenter(bin)};
-        auto y {h.GetBinContent(bin)};
-        if(fXLow <= x && x <= fXUp)
+        auto edges {std::make_shared<std::vector<double>>(fSize + 1)};
+        for(unsigned int i = 0; i <= fSize; i++)
+            (*edges)[i] = axis->GetBinLowEdge(first + i);
+        fEdges = edges->data();
+        fEdgesStore = edges;
+        InitAxis();
+    }
+    Init();
+}
+
+Fitters::Data::Data(const double* x, const double* y, std::size_t n, const double* edges, const double* errors,
+                    const double* weights)
+    : fSize(n)
+{
+    if(fSize < 2)
+        throw std::runtime_error("Data::Data(): size of data is < 2, a required minimum!");
+    auto copy {[](const double* from, std::size_t size, const double*& ptr,
+                  std::shared_ptr<const std::vector<double>>& store)
+               {
+                   if(!from)
+                       return;
+                   auto vec {std::make_shared<std::vector<double>>(from, from + size)};
+                   ptr = vec->data();
+                   store = vec;
+               }};
+    copy(x, n, fX, fXStore);
+    copy(y, n, fY, fYStore);
+    copy(edges, n + 1, fEdges, fEdgesStore);
+    copy(errors, n, fErrors, fErrorsStore);
+    copy(weights, n, fWeights, fWeightsStore);
+    InitAxis();
+    fXLow = GetXLowEdge(0);
+    fXUp = GetXUpEdge(fSize - 1);
+    Init();
+}
+
+Fitters::Data::Data(View, const double* x, const double* y, std::size_t n, const double* edges,
+                    const double* errors, const double* weights)
+    : fX(x),
+      fY(y),
+      fEdges(edges),
+      fErrors(errors),
+      fWeights(weights),
+      fSize(n)
+{
+    if(fSize < 2)
+        throw std::runtime_error("Data::Data(): size of data is < 2, a required minimum!");
+    InitAxis();
+    fXLow = GetXLowEdge(0);
+    fXUp = GetXUpEdge(fSize - 1);
+    Init();
+}
+
+Fitters::Data::Data(View, const Data& bins, const double* y) : Data(bins)
+{
+    fY = y;
+    fYStore.reset();
+    Init();
+}
+
+void Fitters::Data::InitAxis()
+{
+    if(!fEdges)
+    {
+        // Bins around the centres
+        double width {std::abs(fX[1] - fX[0])};
+        auto store {std::make_shared<std::vector<double>>(fSize + 1)};
+        for(unsigned int i = 0; i < fSize; i++)
+            (*store)[i] = fX[i] - 0.5 * width;
+        (*store)[fSize] = fX[fSize - 1] + 0.5 * width;
+        fEdges = store->data();
+        fEdgesStore = store;
+    }
+    fEdge0 = fEdges[0];
+    fBinWidth = (fEdges[fSize] - fEdges[0]) / fSize;
+    // Uniform within rounding of the edges
+    fUniform = true;
+    for(unsigned int i = 0; i < fSize && fUniform; i++)
+        fUniform = std::abs(GetBinWidth(i) - fBinWidth) <= 1e-9 * fBinWidth;
+    // Owned centres at the middle of the bins and owned uniform edges are derived instead (views cost nothing)
+    if(fXStore)
+    {
+        bool middle {true};
+        for(unsigned int i = 0; i < fSize && middle; i++)
+            middle = std::abs(fX[i] - 0.5 * (fEdges[i] + fEdges[i + 1])) <= 1e-9 * fBinWidth;
+        if(middle)
         {
-            fX.push_back(x);
-            fY.push_back(y);
+            fX = nullptr;
+            fXStore.reset();
         }
     }
-    // Set size
-    fSize = fX.size();
-    // Set bin width
-    if(fSize < 2)
-        throw std::runtime_error("Data::Fill(): size of data is < 2, a required minimum!");
-    fBinWidth = std::abs(fX[1] - fX[0]);
+    if(fUniform && fEdgesStore)
+    {
+        fEdges = nullptr;
+        fEdgesStore.reset();
+    }
+    fLazyX = std::make_shared<LazyArray>();
+    fLazyEdges = std::make_shared<LazyArray>();
+}
+
+void Fitters::Data::Init()
+{
+    // Likelihood terms are built if requested
+    fYLogY = std::make_shared<LazyArray>();
+    // Prefix sums for window integrals
+    auto cumY {std::make_shared<std::vector<double>>(fSize + 1)};
+    auto cumVar {std::make_shared<std::vector<double>>(fSize + 1)};
+    for(unsigned int i = 0; i < fSize; i++)
+    {
+        (*cumY)[i + 1] = (*cumY)[i] + fY[i];
+        (*cumVar)[i + 1] = (*cumVar)[i] + (fErrors ? fErrors[i] * fErrors[i] : fY[i]);
+    }
+    fCumY = cumY;
+    fCumVar = cumVar;
+}
+
+const double* Fitters::Data::GetX() const
+{
+    if(fX || !fLazyX)
+        return fX;
+    std::call_once(fLazyX->fFlag,
+                   [this]
+                   {
+                       fLazyX->fValues.resize(fSize);
+                       FillX(0, fSize, fLazyX->fValues.data());
+                   });
+    return fLazyX->fValues.data();
+}
+
+const double* Fitters::Data::GetEdges() const
+{
+    if(fEdges || !fLazyEdges)
+        return fEdges;
+    std::call_once(fLazyEdges->fFlag,
+                   [this]
+                   {
+                       fLazyEdges->fValues.resize(fSize + 1);
+                       FillEdges(0, fSize, fLazyEdges->fValues.data());
+                   });
+    return fLazyEdges->fValues.data();
+}
+
+const double* Fitters::Data::GetYLogY() const
+{
+    if(!fYLogY)
+        return nullptr;
+    std::call_once(fYLogY->fFlag,
+                   [this]
+                   {
+                       auto& ylogy {fYLogY->fValues};
+                       ylogy.resize(fSize);
+                       for(unsigned int i = 0; i < fSize; i++)
+                           ylogy[i] = (fY[i] > 0) ? fY[i] * std::log(fY[i]) - fY[i] : 0;
+                   });
+    return fYLogY->fValues.data();
+}
+
+void Fitters::Data::FillX(unsigned int begin, unsigned int end, double* out) const
+{
+    for(unsigned int i = begin; i < end; i++)
+        out[i - begin] = GetX(i);
+}
+
+void Fitters::Data::FillEdges(unsigned int begin, unsigned int end, double* out) const
+{
+    for(unsigned int i = begin; i <= end; i++)
+        out[i - begin] = GetXLowEdge(i);
 }
 
 int Fitters::Data::GetBin(double x) const
 {
-    int bin {};
-    if(x <= fXLow)
+    if(x <= fEdge0)
         return 0;
-    else if(x >= fXUp)
-        return fX.size() - 1;
+    if(x >= GetXLowEdge(fSize))
+        return fSize - 1;
+    int bin {};
+    if(fUniform)
+        bin = std::min(static_cast<int>((x - fEdge0) / fBinWidth), static_cast<int>(fSize) - 1);
     else
-        bin = int(fX.size() * (x - fXLow) / (fXUp - fXLow));
-    if(bin < 0 || bin >= fX.size())
+        bin = static_cast<int>(std::upper_bound(fEdges, fEdges + fSize + 1, x) - fEdges) - 1;
+    if(bin < 0 || bin >= fSize)
         throw std::runtime_error("Data::GetBin(): wrong bin calculation");
     return bin;
 }
 
 double Fitters::Data::Integral(double xmin, double xmax) const
 {
-    auto low {GetBin(xmin)};
-    auto up {GetBin(xmax)};
-    double ret {};
-    for(auto bin = low; bin <= up; bin++)
-        ret += fY.at(bin);
-    return ret;
+    // Windows out of data contain no bins
+    if(xmax < fEdge0 || xmin > GetXLowEdge(fSize))
+        return 0;
+    return IntegralBins(GetBin(xmin), GetBin(xmax));
+}
+
+double Fitters::Data::IntegralError(double xmin, double xmax) const
+{
+    if(xmax < fEdge0 || xmin > GetXLowEdge(fSize))
+        return 0;
+    return IntegralErrorBins(GetBin(xmin), GetBin(xmax));
+}
+
+double Fitters::Data::IntegralBins(unsigned int low, unsigned int up) const
+{
+    if(low > up || up >= fSize)
+        return 0;
+    return (*fCumY)[up + 1] - (*fCumY)[low];
+}
+
+double Fitters::Data::IntegralErrorBins(unsigned int low, unsigned int up) const
+{
+    if(low > up || up >= fSize)
+        return 0;
+    return std::sqrt(std::max((*fCumVar)[up + 1] - (*fCumVar)[low], 0.));
 }
 
 void Fitters::Data::Print() const
 {
     std::cout << BOLDGREEN << "---- Fitters::Data ----" << RESET << '\n';
     for(int i = 0; i < GetSize(); i++)
-        std::cout << "X : " << fX[i] << " Y : " << fY[i] << '\n';
+        std::cout << "X : " << GetX(i) << " Y : " << fY[i] << '\n';
 }
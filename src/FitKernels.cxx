@@ -0,0 +1,299 @@
+#include "FitKernels.h"
+
+#include "FitVoigt.h"
+
+#include "TMath.h"
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+// Function multiversioning: the compiler emits one clone per target and
+// the dynamic loader picks the best one for the running CPU.
+// Optimization flags of this file are set in CMakeLists.txt
+#if defined(__x86_64__) && defined(__GNUC__) && !defined(__clang__) && !defined(__CLING__)
+#define FITTERS_SIMD __attribute__((target_clones("avx512f", "avx2", "default")))
+#define FITTERS_INLINE inline __attribute__((always_inline))
+#else
+#define FITTERS_SIMD
+#define FITTERS_INLINE inline
+#endif
+
+namespace
+{
+// exp(x) written only with arithmetic and bit operations so that loops calling it are vectorized
+// Range reduction x = k * ln2 + r, |r| <= ln2 / 2, and Horner polynomial of order 13 (relative error ~ 1e-16)
+// Underflows (x <= -709) are flushed to 0
+FITTERS_INLINE double ExpNoBranch(double x)
+{
+    constexpr double kLog2e {1.4426950408889634};
+    constexpr double kLn2Hi {6.93145751953125e-1};
+    constexpr double kLn2Lo {1.42860682030941723212e-6};
+    constexpr double kShift {6755399441055744.0}; // 1.5 * 2^52: rounds to nearest integer
+    double xc {x < -708. ? -708. : (x > 709. ? 709. : x)};
+    double t {xc * kLog2e + kShift};
+    double k {t - kShift};
+    double r {(xc - k * kLn2Hi) - k * kLn2Lo};
+    double p {1. / 6227020800.};
+    p = p * r + 1. / 479001600.;
+    p = p * r + 1. / 39916800.;
+    p = p * r + 1. / 3628800.;
+    p = p * r + 1. / 362880.;
+    p = p * r + 1. / 40320.;
+    p = p * r + 1. / 5040.;
+    p = p * r + 1. / 720.;
+    p = p * r + 1. / 120.;
+    p = p * r + 1. / 24.;
+    p = p * r + 1. / 6.;
+    p = p * r + 0.5;
+    p = p * r + 1.;
+    p = p * r + 1.;
+    // 2^k: low bits of t hold k, move them to the exponent field
+    std::uint64_t bits {};
+    std::memcpy(&bits, &t, sizeof(bits));
+    bits = (bits + 1023) << 52;
+    double scale {};
+    std::memcpy(&scale, &bits, sizeof(scale));
+    // Branch-free flush to zero: factor is 0 for x <= -709 and 1 for x >= -708
+    double keep {x + 709.};
+    keep = keep < 0. ? 0. : (keep > 1. ? 1. : keep);
+    return p * scale * keep;
+}
+
+// log(x) with only arithmetic and bit operations, as ExpNoBranch
+// x = m * 2^e with m in [sqrt(1/2), sqrt(2)), log(m) = 2 atanh(s) with s = (m - 1) / (m + 1), |s| < 0.172,
+// whose odd series is cut at s^21 (relative error ~ 1e-16). Non-positive and subnormal x are clamped
+FITTERS_INLINE double LogNoBranch(double x)
+{
+    constexpr double kMinNormal {2.2250738585072014e-308};
+    constexpr double kLn2 {0.6931471805599453};
+    constexpr double kSqrt2 {1.4142135623730951};
+    double xc {x < kMinNormal ? kMinNormal : x};
+    std::uint64_t bits {};
+    std::memcpy(&bits, &xc, sizeof(bits));
+    // Exponent as double: biased exponent placed in the mantissa of 2^52
+    std::uint64_t ebits {(bits >> 52) | 0x4330000000000000ULL};
+    double e {};
+    std::memcpy(&e, &ebits, sizeof(e));
+    e -= 4503599627371519.; // 2^52 + 1023
+    // Mantissa in [1, 2)
+    std::uint64_t mbits {(bits & 0x000fffffffffffffULL) | 0x3ff0000000000000ULL};
+    double m {};
+    std::memcpy(&m, &mbits, sizeof(m));
+    bool big {m > kSqrt2};
+    m = big ? 0.5 * m : m;
+    e = big ? e + 1 : e;
+    double s {(m - 1) / (m + 1)};
+    double z {s * s};
+    double p {1. / 21};
+    p = p * z + 1. / 19;
+    p = p * z + 1. / 17;
+    p = p * z + 1. / 15;
+    p = p * z + 1. / 13;
+    p = p * z + 1. / 11;
+    p = p * z + 1. / 9;
+    p = p * z + 1. / 7;
+    p = p * z + 1. / 5;
+    p = p * z + 1. / 3;
+    p = p * z + 1.;
+    return e * kLn2 + 2 * s * p;
+}
+
+// erfc(|t|) at an edge t = (edge - mean) / (sigma sqrt2): differences of erf are then taken
+// without cancellation in the tails, where both erf are close to +-1. Contiguous bins share it with the next one
+inline double EdgeErfc(double edge, double mean, double scale)
+{
+    return std::erfc(std::abs((edge - mean) * scale));
+}
+
+// erf(b) - erf(a) from erfc(|a|) and erfc(|b|)
+inline double ErfDiff(double a, double b, double ca, double cb)
+{
+    if(a >= 0)
+        return ca - cb;
+    if(b <= 0)
+        return cb - ca;
+    return 2 - ca - cb;
+}
+} // namespace
+
+FITTERS_SIMD void Fitters::Kernels::Gauss(const double* __restrict x, std::size_t n, double amp, double mean,
+                                          double sigma, double* __restrict out)
+{
+    if(sigma == 0)
+    {
+        // Keep TMath::Gaus behaviour for this degenerate case
+        for(std::size_t i = 0; i < n; i++)
+            out[i] += amp * TMath::Gaus(x[i], mean, sigma);
+        return;
+    }
+    const double inv {1. / sigma};
+    for(std::size_t i = 0; i < n; i++)
+    {
+        double arg {(x[i] - mean) * inv};
+        out[i] += amp * ExpNoBranch(-0.5 * arg * arg);
+    }
+}
+
+FITTERS_SIMD void Fitters::Kernels::GaussGrad(const double* __restrict x, std::size_t n, double amp, double mean,
+                                              double sigma, double* __restrict dAmp, double* __restrict dMean,
+                                              double* __restrict dSigma)
+{
+    const double inv {1. / sigma};
+    for(std::size_t i = 0; i < n; i++)
+    {
+        double arg {(x[i] - mean) * inv};
+        double g {ExpNoBranch(-0.5 * arg * arg)};
+        dAmp[i] = g;
+        dMean[i] = amp * g * arg * inv;
+        dSigma[i] = amp * g * arg * arg * inv;
+    }
+}
+
+void Fitters::Kernels::GaussBinAverage(const double* edges, std::size_t n, double amp, double mean, double sigma,
+                                       double* out)
+{
+    if(sigma <= 0)
+    {
+        // Degenerate width: value at bin center, as without averaging
+        for(std::size_t i = 0; i < n; i++)
+            out[i] += amp * TMath::Gaus(0.5 * (edges[i] + edges[i + 1]), mean, sigma);
+        return;
+    }
+    // Integral of exp(-(x - mean)^2 / (2 sigma^2)) is sigma sqrt(pi / 2) [erf(b) - erf(a)]
+    const double factor {amp * sigma * 1.2533141373155003};
+    const double scale {0.7071067811865476 / sigma};
+    double cl {EdgeErfc(edges[0], mean, scale)};
+    for(std::size_t i = 0; i < n; i++)
+    {
+        double a {(edges[i] - mean) * scale};
+        double b {(edges[i + 1] - mean) * scale};
+        double ch {EdgeErfc(edges[i + 1], mean, scale)};
+        out[i] += factor * ErfDiff(a, b, cl, ch) / (edges[i + 1] - edges[i]);
+        cl = ch;
+    }
+}
+
+void Fitters::Kernels::GaussBinAverageGrad(const double* edges, std::size_t n, double amp, double mean, double sigma,
+                                           double* dAmp, double* dMean, double* dSigma)
+{
+    if(sigma <= 0)
+    {
+        // Consistent with GaussBinAverage: only amplitude contributes
+        for(std::size_t i = 0; i < n; i++)
+        {
+            if(dAmp)
+                dAmp[i] = TMath::Gaus(0.5 * (edges[i] + edges[i + 1]), mean, sigma);
+            if(dMean)
+                dMean[i] = 0;
+            if(dSigma)
+                dSigma[i] = 0;
+        }
+        return;
+    }
+    const double factor {sigma * 1.2533141373155003};
+    const double scale {0.7071067811865476 / sigma};
+    double cl {EdgeErfc(edges[0], mean, scale)};
+    for(std::size_t i = 0; i < n; i++)
+    {
+        double ul {edges[i] - mean};
+        double uh {edges[i + 1] - mean};
+        double width {edges[i + 1] - edges[i]};
+        double el {std::exp(-0.5 * ul * ul / (sigma * sigma))};
+        double eh {std::exp(-0.5 * uh * uh / (sigma * sigma))};
+        // F = integral of the unit-amplitude gaussian over the bin
+        double ch {EdgeErfc(edges[i + 1], mean, scale)};
+        double F {factor * ErfDiff(ul * scale, uh * scale, cl, ch)};
+        cl = ch;
+        if(dAmp)
+            dAmp[i] = F / width;
+        // dF/dmean = e(low) - e(up), dF/dsigma = (F - [u e]) / sigma
+        if(dMean)
+            dMean[i] = amp * (el - eh) / width;
+        if(dSigma)
+            dSigma[i] = amp * (F - (uh * eh - ul * el)) / (sigma * width);
+    }
+}
+
+void Fitters::Kernels::Voigt(const double* x, std::size_t n, double amp, double mean, double sigma, double lg,
+                             double* out)
+{
+    for(std::size_t i = 0; i < n; i++)
+        out[i] += amp * TMath::Voigt(x[i] - mean, sigma, lg);
+}
+
+FITTERS_SIMD void Fitters::Kernels::VoigtFast(const double* __restrict x, std::size_t n, double amp, double mean,
+                                              double sigma, double lg, double* __restrict out)
+{
+    // Degenerate cases as TMath::Voigt: pure Lorentzian or pure Gaussian
+    if(sigma <= 0 || lg < 0)
+    {
+        Voigt(x, n, amp, mean, sigma, lg, out);
+        return;
+    }
+    if(lg == 0)
+    {
+        Gauss(x, n, amp * 0.3989422804014327 / sigma, mean, sigma, out);
+        return;
+    }
+    constexpr double kInvSqrtPi {0.56418958354775628};
+    constexpr int N {Voigt::kWeidemanN};
+    const double L {Voigt::WeidemanL()};
+    const auto& coeffs {Voigt::WeidemanCoefficients()};
+    double a[N];
+    for(int k = 0; k < N; k++)
+        a[k] = coeffs[k];
+    // z = X + iY, with X = (x - mean) / (sigma sqrt2) and Y = lg / (2 sigma sqrt2)
+    const double scale {0.7071067811865476 / sigma};
+    const double Y {0.5 * lg * scale};
+    const double norm {amp * 0.3989422804014327 / sigma};
+    for(std::size_t i = 0; i < n; i++)
+    {
+        double X {(x[i] - mean) * scale};
+        // r = 1 / (L - iz) and Z = (L + iz) / (L - iz), with iz = -Y + iX
+        double D {1. / ((L + Y) * (L + Y) + X * X)};
+        double rr {(L + Y) * D};
+        double ri {X * D};
+        double Zr {(L * L - X * X - Y * Y) * D};
+        double Zi {2 * L * X * D};
+        // Horner on complex p(Z)
+        double pr {a[N - 1]};
+        double pi {0};
+        for(int k = N - 2; k >= 0; k--)
+        {
+            double tmp {pr * Zr - pi * Zi + a[k]};
+            pi = pr * Zi + pi * Zr;
+            pr = tmp;
+        }
+        // Re[w] = Re[2 p r^2 + r / sqrt(pi)]
+        double r2r {rr * rr - ri * ri};
+        double r2i {2 * rr * ri};
+        out[i] += norm * (2 * (pr * r2r - pi * r2i) + kInvSqrtPi * rr);
+    }
+}
+
+FITTERS_SIMD void Fitters::Kernels::Constant(std::size_t n, double amp, double* __restrict out)
+{
+    for(std::size_t i = 0; i < n; i++)
+        out[i] += amp;
+}
+
+FITTERS_SIMD void Fitters::Kernels::Scaled(const double* __restrict in, std::size_t n, double amp,
+                                           double* __restrict out)
+{
+    for(std::size_t i = 0; i < n; i++)
+        out[i] += amp * in[i];
+}
+
+FITTERS_SIMD void Fitters::Kernels::Exp(const double* __restrict in, std::size_t n, double* __restrict out)
+{
+    for(std::size_t i = 0; i < n; i++)
+        out[i] = ExpNoBranch(in[i]);
+}
+
+FITTERS_SIMD void Fitters::Kernels::Log(const double* __restrict in, std::size_t n, double* __restrict out)
+{
+    for(std::size_t i = 0; i < n; i++)
+        out[i] = LogNoBranch(in[i]);
+}
@@ -1,22 +1,39 @@
 #include "FitModel.h"
 
-#include "TF1.h"
-#include "TF1Convolution.h"
 #include "TMath.h"
 #include "TRegexp.h"
 #include "TSpline.h"
 
+#include "FitBreitWigner.h"
+#include "FitConvolution.h"
+#include "FitKernels.h"
+#include "FitVoigt.h"
 #include "PhysColors.h"
 
-#include <functional>
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstddef>
 #include <ios>
 #include <iostream>
 #include <memory>
+#include <mutex>
 #include <stdexcept>
 #include <string>
 #include <utility>
+#include <variant>
 #include <vector>
 
+namespace
+{
+// Gauss-Legendre quadrature of order 6 on [-1, 1]: exact for polynomials up to degree 11
+constexpr std::size_t kNGL {6};
+constexpr std::array<double, kNGL> kGLNodes {-0.9324695142031521, -0.6612093864662645, -0.2386191860831909,
+                                             0.2386191860831909,  0.6612093864662645,  0.9324695142031521};
+constexpr std::array<double, kNGL> kGLWeights {0.1713244923791704, 0.3607615730481386, 0.4679139345726910,
+                                               0.4679139345726910, 0.3607615730481386, 0.1713244923791704};
+} // namespace
+
 Fitters::Model::Model(int ngaus, int nvoigt, const std::vector<TH1D>& ps, bool withCte)
     : fNGauss(ngaus),
       fNVoigt(nvoigt),
@@ -26,10 +43,33 @@ Fitters::Model::Model(int ngaus, int nvoigt, const std::vector<TH1D>& ps, bool w
 {
     fPars = std::vector<double>(NPar());
     fParNames = std::vector<std::string>(NPar());
-    fChart = std::vector<std::pair<std::string, unsigned int>>(NPar());
     InitFuncParNames();
     InitParNames();
+    InitLayout();
     InitSplines();
+    fConvCache = std::make_shared<ConvCache>();
+    // Six shifted shapes per voigt: those of the last gradient
+    fGradConvCache = std::make_shared<ConvCache>(6 * std::max(fNVoigt, 1));
+}
+
+Fitters::Model* Fitters::Model::Clone() const
+{
+    static std::mutex mutex;
+    Model* ret {};
+    {
+        std::lock_guard<std::mutex> lock {mutex};
+        ret = new Model {fNGauss, fNVoigt, fPS, fCte};
+    }
+    ret->SetParameters(Parameters());
+    ret->SetUseSpline(fUseSpline);
+    ret->SetVoigtMode(fVoigtMode);
+    ret->SetGammaFuncs(fGammaFuncs);
+    ret->SetNConvolutionPoints(fNConvolutionPoints);
+    ret->fConvCache = fConvCache;
+    ret->fConvTables = fConvTables;
+    ret->fConvRange = fConvRange;
+    ret->fPSGrids = fPSGrids;
+    return ret;
 }
 
 void Fitters::Model::InitSplines()
@@ -49,6 +89,77 @@ double Fitters::Model::EvalPS(unsigned int i, double x) const
     }
 }
 
+void Fitters::Model::SamplePS(const double* x, std::size_t n)
+{
+    if(fPS.empty() || n < 2)
+        return;
+    double x0 {x[0]};
+    double step {(x[n - 1] - x[0]) / (n - 1)};
+    // Already sampled: called once per FCN, so this is checked first
+    if(HasPSGrid(x0, step, n))
+        return;
+    // Only uniform grids are located by value later
+    const double tol {1e-6 * std::abs(step)};
+    for(std::size_t i = 0; i < n; i++)
+        if(std::abs(x[i] - (x0 + i * step)) > tol)
+            return;
+    SamplePS(x0, step, n);
+}
+
+bool Fitters::Model::HasPSGrid(double x0, double step, std::size_t n) const
+{
+    const double tol {1e-6 * std::abs(step)};
+    for(const auto& g : fPSGrids)
+        if(g.fN == n && g.fUseSpline == fUseSpline && std::abs(g.fX0 - x0) <= tol &&
+           std::abs(g.fStep - step) <= 1e-9 * std::abs(step))
+            return true;
+    return false;
+}
+
+void Fitters::Model::SamplePS(double x0, double step, std::size_t n)
+{
+    if(fPS.empty() || n < 2 || HasPSGrid(x0, step, n))
+        return;
+    PSGrid grid {x0, step, n, fUseSpline, {}};
+    grid.fSamples.resize(fPS.size());
+    for(int ps = 0; ps < fNPS; ps++)
+    {
+        grid.fSamples[ps].resize(n);
+        for(std::size_t i = 0; i < n; i++)
+            grid.fSamples[ps][i] = EvalPS(ps, grid.fX0 + i * grid.fStep);
+    }
+    // Keep only a few grids: data and divisions of the current fit
+    const std::size_t maxGrids {4};
+    if(fPSGrids.size() >= maxGrids)
+        fPSGrids.erase(fPSGrids.begin());
+    fPSGrids.push_back(std::move(grid));
+}
+
+const double* Fitters::Model::FindPSSamples(int idx, const double* x, std::size_t n) const
+{
+    if(n == 0)
+        return nullptr;
+    for(const auto& g : fPSGrids)
+    {
+        if(g.fUseSpline != fUseSpline)
+            continue;
+        const double tol {1e-6 * std::abs(g.fStep)};
+        // Position of first point in grid
+        auto pos {std::llround((x[0] - g.fX0) / g.fStep)};
+        if(pos < 0 || static_cast<std::size_t>(pos) + n > g.fN)
+            continue;
+        std::size_t offset = pos;
+        // Every point must be on the grid: arrays matching only at some points would read wrong samples
+        // (one compare per point, much cheaper than evaluating the phase space)
+        bool match {true};
+        for(std::size_t i = 0; i < n && match; i++)
+            match = std::abs(x[i] - (g.fX0 + (offset + i) * g.fStep)) <= tol;
+        if(match)
+            return g.fSamples[idx].data() + offset;
+    }
+    return nullptr;
+}
+
 void Fitters::Model::InitFuncParNames()
 {
     fFuncParNames = {
@@ -69,8 +180,6 @@ void Fitters::Model::InitParNames()
             unsigned int idx {i * fNParGauss + p};
             // Set parameter name
             fParNames[idx] = "g" + std::to_string(i) + fFuncParNames["g"][p];
-            // Push to chart
-            fChart[idx] = {"g", i};
         }
     }
     unsigned int offset {static_cast<unsigned int>(fNGauss * fNParGauss)};
@@ -82,8 +191,6 @@ void Fitters::Model::InitParNames()
             unsigned int idx {i * fNParVoigt + p + offset};
             // Set name
             fParNames[idx] = "v" + std::to_string(i) + fFuncParNames["v"][p];
-            // Push to chart
-            fChart[idx] = {"v", i};
         }
     }
     offset += fNVoigt * fNParVoigt;
@@ -95,8 +202,6 @@ void Fitters::Model::InitParNames()
             unsigned int idx {i * fNParPS + p + offset};
             // Set name
             fParNames[idx] = "ps" + std::to_string(i) + fFuncParNames["ps"][p];
-            // Chart
-            fChart[idx] = {"ps", i};
         }
     }
     offset += fNPS * fNParPS;
@@ -105,11 +210,53 @@ void Fitters::Model::InitParNames()
     {
         // Set name
         fParNames[offset] = "cte0_Amp";
-        // Push to chart
-        fChart[offset] = {"cte", 0};
     }
 }
 
+void Fitters::Model::InitLayout()
+{
+    // Same ordering as parameter names: gaus, voigt, ps and cte
+    fComponents.clear();
+    for(int i = 0; i < fNGauss; i++)
+        fComponents.push_back({FuncType::kGauss, i, GetOffset(FuncType::kGauss, i),
+                               static_cast<unsigned int>(fNParGauss)});
+    for(int i = 0; i < fNVoigt; i++)
+        fComponents.push_back({FuncType::kVoigt, i, GetOffset(FuncType::kVoigt, i),
+                               static_cast<unsigned int>(fNParVoigt)});
+    for(int i = 0; i < fNPS; i++)
+        fComponents.push_back({FuncType::kPS, i, GetOffset(FuncType::kPS, i), static_cast<unsigned int>(fNParPS)});
+    if(fCte)
+        fComponents.push_back({FuncType::kCte, 0, GetOffset(FuncType::kCte, 0), 1});
+}
+
+unsigned int Fitters::Model::GetOffset(FuncType type, int idx) const
+{
+    unsigned int voigt {static_cast<unsigned int>(fNGauss * fNParGauss)};
+    unsigned int ps {voigt + fNVoigt * fNParVoigt};
+    unsigned int cte {ps + fNPS * fNParPS};
+    switch(type)
+    {
+    case FuncType::kGauss: return idx * fNParGauss;
+    case FuncType::kVoigt: return voigt + idx * fNParVoigt;
+    case FuncType::kPS: return ps + idx * fNParPS;
+    case FuncType::kCte: return cte;
+    }
+    throw std::runtime_error("Model::GetOffset(): received wrong type of func");
+}
+
+std::string Fitters::Model::GetComponentLabel(const Component& comp) const
+{
+    std::string type {};
+    switch(comp.fType)
+    {
+    case FuncType::kGauss: type = "g"; break;
+    case FuncType::kVoigt: type = "v"; break;
+    case FuncType::kPS: type = "ps"; break;
+    case FuncType::kCte: type = "cte"; break;
+    }
+    return type + std::to_string(comp.fIdx);
+}
+
 std::pair<std::string, int> Fitters::Model::GetTypeIdx(const std::string& name) const
 {
 
@@ -134,25 +281,11 @@ unsigned int Fitters::Model::GetIdxFromLabel(const std::string& typeIdx, unsigne
 
 Fitters::Model::ParVec Fitters::Model::UnpackParameters(const double* pars) const
 {
-    ParPack gaus(fNGauss);
-    ParPack voigt(fNVoigt);
-    ParPack ps(fNPS);
-    ParPack cte(fCte);
-    for(int p = 0; p < NPar(); p++)
-    {
-        auto [type, idx] {fChart[p]};
-        if(type == "g")
-            gaus[idx].push_back(pars[p]);
-        else if(type == "v")
-            voigt[idx].push_back(pars[p]);
-        else if(type == "ps")
-            ps[idx].push_back(pars[p]);
-        else if(type == "cte")
-            cte[idx].push_back(pars[p]);
-        else
-            throw std::runtime_error("Model::UnpackParameters(): received wrong type of func");
-    }
-    return {std::move(gaus), std::move(voigt), std::move(ps), std::move(cte)};
+    // Kept for external use: evaluation itself reads directly from the flat layout
+    ParVec ret {ParPack(fNGauss), ParPack(fNVoigt), ParPack(fNPS), ParPack(fCte)};
+    for(const auto& comp : fComponents)
+        ret[static_cast<int>(comp.fType)][comp.fIdx].assign(pars + comp.fOffset, pars + comp.fOffset + comp.fNPar);
+    return ret;
 }
 
 unsigned int Fitters::Model::NPar() const
@@ -172,9 +305,9 @@ double Fitters::Model::EvalWithPacks(double x, ParPack& gaus, ParPack& voigt, Pa
     {
         if(fGammaFuncs.count(v))
         {
-            if(fConvObjs.count(v))
+            if(fConvTables.count(v))
             {
-                ret += voigt[v][0] * (*fConvObjs.at(v))(&x, nullptr);
+                ret += voigt[v][0] * fConvTables.at(v)->Eval(x);
             }
             else
             {
@@ -186,7 +319,7 @@ double Fitters::Model::EvalWithPacks(double x, ParPack& gaus, ParPack& voigt, Pa
         else
         {
             // Without penetrability, use standard Voigt from ROOT
-            ret += voigt[v][0] * TMath::Voigt(x - voigt[v][1], voigt[v][2], voigt[v][3]);
+            ret += voigt[v][0] * Voigt::Eval(x - voigt[v][1], voigt[v][2], voigt[v][3], fVoigtMode);
         }
     }
     // 3-->Phase spaces
@@ -201,157 +334,423 @@ double Fitters::Model::EvalWithPacks(double x, ParPack& gaus, ParPack& voigt, Pa
     return ret;
 }
 
-double Fitters::Model::DoEvalPar(const double* xx, const double* p) const
+double Fitters::Model::EvalComponent(const Component& comp, double x, const double* p) const
 {
-    double x {xx[0]};
-    // Unpack parameters = c-like array to our data structure
-    // Check of null based on ROOT's forum answer
-    // https://root-forum.cern.ch/t/error-on-doevalpar-with-custom-fit-model-and-root-fitter/58158/3?u=loopset
-    const double* pars {(p) ? p : fPars.data()};
-    auto pack = UnpackParameters(pars);
-    auto gaus = pack[0];
-    auto voigt = pack[1];
-    auto phase = pack[2];
-    auto cte = pack[3];
-    // Call the public function
-    return EvalWithPacks(x, gaus, voigt, phase, cte);
-}
-
-void Fitters::Model::Print() const
-{
-    std::cout << BOLDYELLOW << "···· Model func settings ····" << '\n';
-    std::cout << "-> NGauss : " << fNGauss << '\n';
-    std::cout << "-> NVoigt : " << fNVoigt << '\n';
-    std::cout << "-> NPS    : " << fNPS << '\n';
-    std::cout << "-> Cte    ? " << std::boolalpha << fCte << '\n';
-    std::cout << "-> UseSpline ? " << std::boolalpha << fUseSpline << '\n';
-    std::cout << "-> NGammaFuncs(l) : " << fGammaFuncs.size() << '\n';
-    std::cout << "······························" << RESET << '\n';
-}
-
-Fitters::Model::GammaFunc Fitters::Model::InitLambda(int l, double s, double mu, double R)
-{
-    // Define penetrability function based on l and parameters (expresion of Gamma in R-matrix theory without Gamma0
-    // parameter)
-    std::function<double(double, double)> penetrability;
-    double hbar {197.3269804}; // MeV*fm
-    // x = Ex, mean = Er, s = separation energy, mu = reduced mass, R = channel radius
-    if(l == 0)
+    // Parameters of this component start at its offset
+    const double* pars {p + comp.fOffset};
+    switch(comp.fType)
     {
-        // x - s = Ed = decay energy, mean = resonance energy
-        penetrability = [hbar, s](double x, double mean) { return std::pow((x - s) / mean, 0.5); };
+    case FuncType::kGauss: return pars[0] * TMath::Gaus(x, pars[1], pars[2]);
+    case FuncType::kVoigt:
+        if(fGammaFuncs.count(comp.fIdx))
+        {
+            return pars[0] * GetCurrentConvTable(comp.fIdx).Eval(x);
+        }
+        // Without penetrability, use standard Voigt in the chosen mode
+        return pars[0] * Voigt::Eval(x - pars[1], pars[2], pars[3], fVoigtMode);
+    case FuncType::kPS: return pars[0] * EvalPS(comp.fIdx, x);
+    case FuncType::kCte: return pars[0];
     }
+    return 0;
+}
+
+double Fitters::Model::Eval(double x, const double* p) const
+{
+    double ret {};
+    for(const auto& comp : fComponents)
+        ret += EvalComponent(comp, x, p);
+    return ret;
+}
 
-    else if(l == 1)
+void Fitters::Model::EvalComponentBatch(const Component& comp, const double* x, std::size_t n, const double* p,
+                                        double* out) const
+{
+    // Accumulates into out
+    const double* pars {p + comp.fOffset};
+    switch(comp.fType)
     {
-        penetrability = [hbar, s, mu, R](double x, double mean)
+    case FuncType::kGauss: Kernels::Gauss(x, n, pars[0], pars[1], pars[2], out); break;
+    case FuncType::kVoigt:
+        if(fGammaFuncs.count(comp.fIdx))
         {
-            return std::pow((x - s) / mean, 1.5) * (2 * (x - s) / (mean + (x - s))) *
-                   (1. + (2. * mu * mean * R * R) / (hbar * hbar)) / (1. + (2. * mu * (x - s) * R * R) / (hbar * hbar));
-        };
+            GetCurrentConvTable(comp.fIdx).EvalBatch(x, n, pars[0], out);
+        }
+        else if(fVoigtMode == Voigt::Mode::kFast)
+            Kernels::VoigtFast(x, n, pars[0], pars[1], pars[2], pars[3], out);
+        else
+            Kernels::Voigt(x, n, pars[0], pars[1], pars[2], pars[3], out);
+        break;
+    case FuncType::kPS:
+        // Multiply-add on sampled grid, direct evaluation otherwise (plotting grids)
+        if(const auto* samples {FindPSSamples(comp.fIdx, x, n)})
+            Kernels::Scaled(samples, n, pars[0], out);
+        else
+            for(std::size_t i = 0; i < n; i++)
+                out[i] += pars[0] * EvalPS(comp.fIdx, x[i]);
+        break;
+    case FuncType::kCte: Kernels::Constant(n, pars[0], out); break;
     }
+}
 
-    else if(l == 2)
+void Fitters::Model::EvalBatch(const double* x, std::size_t n, const double* p, double* out) const
+{
+    const double* pars {(p) ? p : fPars.data()};
+    std::fill(out, out + n, 0.);
+    for(const auto& comp : fComponents)
+        EvalComponentBatch(comp, x, n, pars, out);
+}
+
+void Fitters::Model::EvalComponentGradBatch(const Component& comp, const double* x, std::size_t n, const double* p,
+                                            double* const* rows) const
+{
+    // Overwrites rows
+    const double* pars {p + comp.fOffset};
+    switch(comp.fType)
     {
-        penetrability = [hbar, s, mu, R](double x, double mean)
+    case FuncType::kGauss:
+    {
+        // Kernel writes the three rows at once: use scratch for those not requested
+        std::array<double*, 3> out {};
+        for(unsigned int k = 0; k < out.size(); k++)
+        {
+            if(rows[k])
+                out[k] = rows[k];
+            else
+            {
+                if(fGradScratch.size() < n)
+                    fGradScratch.resize(n);
+                out[k] = fGradScratch.data();
+            }
+        }
+        if(pars[2] == 0)
+        {
+            // Degenerate width: only amplitude contributes, as in EvalComponent
+            for(std::size_t i = 0; i < n; i++)
+            {
+                out[0][i] = TMath::Gaus(x[i], pars[1], pars[2]);
+                out[1][i] = out[2][i] = 0;
+            }
+        }
+        else
+            Kernels::GaussGrad(x, n, pars[0], pars[1], pars[2], out[0], out[1], out[2]);
+        break;
+    }
+    case FuncType::kVoigt:
+        if(fGammaFuncs.count(comp.fIdx))
+        {
+            EvalConvolutionGradBatch(comp, x, n, p, rows);
+            break;
+        }
+        for(std::size_t i = 0; i < n; i++)
         {
-            return std::pow((x - s) / mean, 2.5) * (2 * (x - s) / (mean + (x - s))) *
-                   (9. + (6. * mu * mean * R * R) / (hbar * hbar) +
-                    std::pow((2. * mu * mean * R * R) / (hbar * hbar), 2)) /
-                   (9. + (6. * mu * (x - s) * R * R) / (hbar * hbar) +
-                    std::pow((2. * mu * (x - s) * R * R) / (hbar * hbar), 2));
-        };
+            double val {};
+            double dx {};
+            double dsigma {};
+            double dlg {};
+            // All rows from the same profile EvalComponent returns
+            if(fVoigtMode == Voigt::Mode::kFast)
+                Voigt::Derivatives(x[i] - pars[1], pars[2], pars[3], val, dx, dsigma, dlg);
+            else
+                Voigt::DerivativesReference(x[i] - pars[1], pars[2], pars[3], val, dx, dsigma, dlg);
+            if(rows[0])
+                rows[0][i] = val;
+            if(rows[1])
+                rows[1][i] = -pars[0] * dx;
+            if(rows[2])
+                rows[2][i] = pars[0] * dsigma;
+            if(rows[3])
+                rows[3][i] = pars[0] * dlg;
+        }
+        break;
+    case FuncType::kPS:
+        if(!rows[0])
+            break;
+        if(const auto* samples {FindPSSamples(comp.fIdx, x, n)})
+            std::copy(samples, samples + n, rows[0]);
+        else
+            for(std::size_t i = 0; i < n; i++)
+                rows[0][i] = EvalPS(comp.fIdx, x[i]);
+        break;
+    case FuncType::kCte:
+        if(rows[0])
+            std::fill(rows[0], rows[0] + n, 1.);
+        break;
     }
-    else
+}
+
+void Fitters::Model::EvalConvolutionGradBatch(const Component& comp, const double* x, std::size_t n, const double* p,
+                                              double* const* rows) const
+{
+    // Layout [0]=amp, [1]=mean, [2]=sigma, [3]=Gamma0
+    const double* pars {p + comp.fOffset};
+    if(rows[0])
     {
-        throw std::runtime_error("Model::InitLambda(): currently only l = 0, 1, 2 are implemented");
+        std::fill(rows[0], rows[0] + n, 0.);
+        GetCurrentConvTable(comp.fIdx).EvalBatch(x, n, 1, rows[0]);
+    }
+    // Central differences: steps are a fraction of the widths, so that FFT sampling noise does not dominate
+    // Shifted shapes go through a small cache of this model, so they are reused while the shape does not move
+    // without evicting the shapes of the fit from the shared one
+    double width {std::max(std::abs(pars[2]), 1e-3)};
+    std::array<double, 3> steps {1e-2 * width, 1e-2 * width, 1e-2 * std::max(std::abs(pars[3]), 1e-3)};
+    for(int k = 1; k < 4; k++)
+    {
+        auto* row {rows[k]};
+        if(!row)
+            continue;
+        double h {steps[k - 1]};
+        std::array<double, 3> up {pars[1], pars[2], pars[3]};
+        std::array<double, 3> down {up};
+        up[k - 1] += h;
+        down[k - 1] -= h;
+        auto tup {GetConvTable(comp.fIdx, up[0], up[1], up[2], fGradConvCache)};
+        auto tdown {GetConvTable(comp.fIdx, down[0], down[1], down[2], fGradConvCache)};
+        std::fill(row, row + n, 0.);
+        tup->EvalBatch(x, n, pars[0] / (2 * h), row);
+        tdown->EvalBatch(x, n, -pars[0] / (2 * h), row);
     }
-    // Now with the Gamma defined, we return the Breit-Wirgner implementation (Lorentz formula)
-    // where x = Ex, mean = Er and Gamma0 is the width at resonance energy (Gamma(Er) = Gamma0)
-    auto ret {[penetrability, s](double x, double mean, double Gamma0)
-              {
-                  if(x <= s)
-                      return 0.0;
-                  double Gamma = Gamma0 * penetrability(x, mean);
-                  return Gamma * 0.159154943 / ((x - mean) * (x - mean) + Gamma * Gamma / 4);
-              }};
-    return ret;
 }
 
-// s -> separation energy [MeV], mu -> reduced mass [MeV/c^2], R -> channel radius [fm]
-void Fitters::Model::AddBWL(int vIdx, int l, double s, double mu, double R)
+bool Fitters::Model::HasBinAverage(const Component& comp) const
 {
-    fGammaFuncs[vIdx] = InitLambda(l, s, mu, R);
+    switch(comp.fType)
+    {
+    case FuncType::kGauss: return true;
+    case FuncType::kVoigt: return !fGammaFuncs.count(comp.fIdx);
+    case FuncType::kPS: return false;
+    case FuncType::kCte: return true;
+    }
+    return false;
 }
 
-// Helper method to initialize or update Breit-Wigner function
-void Fitters::Model::InitOrUpdateBW(int vIdx, double mean, double Gamma0, double xMin, double xMax)
+std::size_t Fitters::Model::GetBinAverageScratch(std::size_t n)
 {
-    if(!fBWs.count(vIdx))
+    // Nodes and the value (or the derivatives, up to 4 parameters) of a voigt at each of them
+    return 5 * n * kNGL;
+}
+
+void Fitters::Model::BuildBinNodes(const double* edges, std::size_t n, double* nodes) const
+{
+    for(std::size_t i = 0; i < n; i++)
     {
-        // Create lambda for Breit-Wigner function compatible with TF1
-        auto bwLambda {[this, vIdx](double* x, double* p)
-                       {
-                           double mean {p[0]};
-                           double Gamma0 {p[1]};
-                           return this->fGammaFuncs.at(vIdx)(x[0], mean, Gamma0);
-                       }};
-
-        // Create TF1 object (2 parameters: mean and Gamma0)
-        fBWs[vIdx] = std::make_shared<TF1>(("fBW_v" + std::to_string(vIdx)).c_str(), bwLambda, xMin, xMax, 2);
+        double center {0.5 * (edges[i] + edges[i + 1])};
+        double half {0.5 * (edges[i + 1] - edges[i])};
+        for(std::size_t k = 0; k < kNGL; k++)
+            nodes[i * kNGL + k] = center + half * kGLNodes[k];
     }
 }
 
-// Helper method to initialize or update Gaussian function
-void Fitters::Model::InitOrUpdateGaussian(int vIdx, double sigma, double xMin, double xMax)
+void Fitters::Model::EvalComponentBinAverage(const Component& comp, const double* edges, std::size_t n,
+                                             const double* p, double* out, double* scratch) const
 {
-    if(!fGaussians.count(vIdx))
+    const double* pars {p + comp.fOffset};
+    switch(comp.fType)
+    {
+    case FuncType::kGauss: Kernels::GaussBinAverage(edges, n, pars[0], pars[1], pars[2], out); break;
+    case FuncType::kVoigt:
     {
-        // Create TF1 object (1 parameter: sigma)
-        fGaussians[vIdx] = std::make_shared<TF1>(("fGauss_v" + std::to_string(vIdx)).c_str(),
-                                                 "TMath::Gaus(x, 0, [0], true)", xMin, xMax);
+        if(!HasBinAverage(comp))
+            throw std::runtime_error("Model::EvalComponentBinAverage(): no bin average for voigts with penetrability");
+        // Evaluate at all nodes at once and reduce per bin (weights sum 2)
+        std::size_t nnodes {n * kNGL};
+        double* nodes {scratch};
+        double* vals {scratch + nnodes};
+        BuildBinNodes(edges, n, nodes);
+        std::fill(vals, vals + nnodes, 0.);
+        EvalComponentBatch(comp, nodes, nnodes, p, vals);
+        for(std::size_t i = 0; i < n; i++)
+        {
+            double sum {};
+            for(std::size_t k = 0; k < kNGL; k++)
+                sum += kGLWeights[k] * vals[i * kNGL + k];
+            out[i] += 0.5 * sum;
+        }
+        break;
+    }
+    case FuncType::kPS:
+        throw std::runtime_error("Model::EvalComponentBinAverage(): no bin average for phase spaces");
+    case FuncType::kCte: Kernels::Constant(n, pars[0], out); break;
     }
 }
 
-// Helper method to initialize or update Convolution function
-void Fitters::Model::InitOrUpdateConvolution(int vIdx, double mean, double sigma, double Gamma0, double xMin,
-                                             double xMax)
+void Fitters::Model::EvalComponentBinAverageGrad(const Component& comp, const double* edges, std::size_t n,
+                                                 const double* p, double* const* rows, double* scratch) const
 {
-    // First ensure BW and Gaussian are initialized/updated
-    InitOrUpdateBW(vIdx, mean, Gamma0, xMin, xMax);
-    InitOrUpdateGaussian(vIdx, sigma, xMin, xMax);
+    const double* pars {p + comp.fOffset};
+    switch(comp.fType)
+    {
+    case FuncType::kGauss:
+        Kernels::GaussBinAverageGrad(edges, n, pars[0], pars[1], pars[2], rows[0], rows[1], rows[2]);
+        break;
+    case FuncType::kVoigt:
+    {
+        if(!HasBinAverage(comp))
+            throw std::runtime_error(
+                "Model::EvalComponentBinAverageGrad(): no bin average for voigts with penetrability");
+        // Derivatives at the nodes, reduced per bin as the values
+        std::size_t nnodes {n * kNGL};
+        double* nodes {scratch};
+        BuildBinNodes(edges, n, nodes);
+        std::array<double*, 4> nodeRows {};
+        for(unsigned int k = 0; k < comp.fNPar; k++)
+            nodeRows[k] = rows[k] ? scratch + (k + 1) * nnodes : nullptr;
+        EvalComponentGradBatch(comp, nodes, nnodes, p, nodeRows.data());
+        for(unsigned int k = 0; k < comp.fNPar; k++)
+        {
+            if(!rows[k])
+                continue;
+            for(std::size_t i = 0; i < n; i++)
+            {
+                double sum {};
+                for(std::size_t j = 0; j < kNGL; j++)
+                    sum += kGLWeights[j] * nodeRows[k][i * kNGL + j];
+                rows[k][i] = 0.5 * sum;
+            }
+        }
+        break;
+    }
+    case FuncType::kPS:
+        throw std::runtime_error("Model::EvalComponentBinAverageGrad(): no bin average for phase spaces");
+    case FuncType::kCte:
+        if(rows[0])
+            std::fill(rows[0], rows[0] + n, 1.);
+        break;
+    }
+}
 
-    if(!fConvObjs.count(vIdx))
+double Fitters::Model::IntegralComponent(const Component& comp, const double* p, double xmin, double xmax) const
+{
+    const double* pars {p + comp.fOffset};
+    switch(comp.fType)
     {
-        // Create convolution object (only once)
-        fConvObjs[vIdx] = std::make_shared<TF1Convolution>(fBWs[vIdx].get(), fGaussians[vIdx].get());
-        fConvObjs[vIdx]->SetRange(xMin, xMax);
-        if(fNConvolutionPoints > 0)
-            fConvObjs[vIdx]->SetNofPointsFFT(fNConvolutionPoints);
+    case FuncType::kGauss:
+    {
+        // A sigma sqrt(pi / 2) [erf(ub) - erf(ua)], u = (x - mean) / (sqrt(2) sigma)
+        double scale {M_SQRT2 * pars[2]};
+        return pars[0] * pars[2] * std::sqrt(M_PI / 2) *
+               (std::erf((xmax - pars[1]) / scale) - std::erf((xmin - pars[1]) / scale));
+    }
+    case FuncType::kVoigt: return pars[0] * Voigt::Integral(xmin - pars[1], xmax - pars[1], pars[2], pars[3]);
+    case FuncType::kPS:
+    case FuncType::kCte: break;
     }
-    // Update parameters: [0]=mean, [1]=Gamma0, [2]=sigma
-    fConvObjs[vIdx]->SetParameters(mean, Gamma0, sigma);
+    throw std::runtime_error("Model::IntegralComponent(): only gaussians and voigts are integrated");
+}
+
+void Fitters::Model::ParameterGradient(const double* x, const double* p, double* grad) const
+{
+    const double* pars {(p) ? p : fPars.data()};
+    for(const auto& comp : fComponents)
+    {
+        std::array<double*, 4> rows {};
+        for(unsigned int k = 0; k < comp.fNPar; k++)
+            rows[k] = grad + comp.fOffset + k;
+        EvalComponentGradBatch(comp, x, 1, pars, rows.data());
+    }
+}
+
+double Fitters::Model::DoParameterDerivative(const double* x, const double* p, unsigned int ipar) const
+{
+    const double* pars {(p) ? p : fPars.data()};
+    for(const auto& comp : fComponents)
+    {
+        if(ipar < comp.fOffset || ipar >= comp.fOffset + comp.fNPar)
+            continue;
+        // Compute only the requested row
+        double val {};
+        std::array<double*, 4> rows {};
+        rows[ipar - comp.fOffset] = &val;
+        EvalComponentGradBatch(comp, x, 1, pars, rows.data());
+        return val;
+    }
+    throw std::runtime_error("Model::DoParameterDerivative(): ipar out of range");
+}
+
+double Fitters::Model::DoEvalPar(const double* xx, const double* p) const
+{
+    // Check of null based on ROOT's forum answer
+    // https://root-forum.cern.ch/t/error-on-doevalpar-with-custom-fit-model-and-root-fitter/58158/3?u=loopset
+    const double* pars {(p) ? p : fPars.data()};
+    // No unpacking: read straight from the c-like array
+    return Eval(xx[0], pars);
+}
+
+void Fitters::Model::Print(std::ostream& out) const
+{
+    out << BOLDYELLOW << "···· Model func settings ····" << '\n';
+    out << "-> NGauss : " << fNGauss << '\n';
+    out << "-> NVoigt : " << fNVoigt << '\n';
+    out << "-> NPS    : " << fNPS << '\n';
+    out << "-> Cte    ? " << std::boolalpha << fCte << '\n';
+    out << "-> UseSpline ? " << std::boolalpha << fUseSpline << '\n';
+    out << "-> VoigtMode : " << (fVoigtMode == Voigt::Mode::kFast ? "fast" : "reference") << '\n';
+    out << "-> NGammaFuncs(l) : " << fGammaFuncs.size() << '\n';
+    out << "······························" << RESET << '\n';
+}
+
+// s -> separation energy [MeV], mu -> reduced mass [MeV/c^2], R -> channel radius [fm]
+// z1z2 -> product of charges of the decay products: Coulomb penetrabilities if > 0
+void Fitters::Model::AddBWL(int vIdx, int l, double s, double mu, double R, double z1z2)
+{
+    fGammaFuncs[vIdx] = BWL::Make(l, s, mu, R, z1z2);
+}
+
+void Fitters::Model::SetGammaFuncs(const std::map<int, BWL::Custom::Function>& funcs)
+{
+    fGammaFuncs.clear();
+    for(const auto& [vIdx, func] : funcs)
+        fGammaFuncs[vIdx] = BWL::Custom {func};
+}
+
+std::shared_ptr<const Fitters::ConvTable> Fitters::Model::GetConvTable(int vIdx, double mean, double sigma,
+                                                                       double Gamma0,
+                                                                       const std::shared_ptr<ConvCache>& cache) const
+{
+    auto [xMin, xMax] {fConvRange};
+    int npoints {GetConvolutionPoints()};
+    const auto& gamma {fGammaFuncs.at(vIdx)};
+    auto build {[&]()
+                {
+                    fNConvolutions++;
+                    auto sampler {[&](const double* x, std::size_t n, double* out)
+                                  { BWL::EvalBatch(gamma, x, n, mean, Gamma0, out); }};
+                    return Convolution::Gaussian(sampler, sigma, xMin, xMax, npoints);
+                }};
+    if(!cache)
+        return build();
+    auto bwl {BWL::GetPars(gamma)};
+    ConvCache::Key key {bwl[0], bwl[1], bwl[2], bwl[3], bwl[4], mean, sigma, Gamma0, xMin, xMax,
+                        static_cast<double>(npoints)};
+    return cache->Get(key, build);
+}
+
+const Fitters::ConvTable& Fitters::Model::GetCurrentConvTable(int vIdx) const
+{
+    auto it {fConvTables.find(vIdx)};
+    if(it == fConvTables.end())
+        throw std::runtime_error("Model::GetCurrentConvTable(): gamma function exists for this Voigt but no "
+                                 "convolution found. Please call TriggerConvolution before evaluating the model.");
+    return *it->second;
 }
 
-// Simplified ComputeConvolutionSplines - now uses cached TF1s directly
 void Fitters::Model::TriggerConvolution(const double* p, double xMin, double xMax)
 {
     // Check if we have any gamma function, if not, no need to compute
     if(fGammaFuncs.empty())
         return;
-
-    // Unpack parameters (once per call)
-    auto pack {UnpackParameters(p)};
-    auto voigt {pack[1]};
-
-    for(const auto& [vIdx, gammaFunc] : fGammaFuncs)
+    fConvRange = {xMin, xMax};
+    for(auto& [vIdx, gammaFunc] : fGammaFuncs)
     {
-        double amplitude {voigt[vIdx][0]};
-        double mean {voigt[vIdx][1]};
-        double sigma {voigt[vIdx][2]};
-        double Gamma0 {voigt[vIdx][3]};
-
-        // Initialize or update the convolution TF1 with current parameters
-        InitOrUpdateConvolution(vIdx, mean, sigma, Gamma0, xMin, xMax);
+        // Read pars from flat layout: [0]=amp, [1]=mean, [2]=sigma, [3]=Gamma0
+        const double* pars {p + GetOffset(FuncType::kVoigt, vIdx)};
+        // Coulomb penetrabilities are tabulated on the range sampled by the convolution (padded by 8 sigma and a
+        // step, see Convolution::Gaussian) and the resonance energy
+        if(auto* coulomb {std::get_if<BWL::Coulomb>(&gammaFunc)})
+        {
+            double pad {9 * std::abs(pars[2]) + 2 * (xMax - xMin) / std::max(GetConvolutionPoints() - 1, 1)};
+            coulomb->Cover(std::min(xMin - pad, pars[1]), std::max(xMax + pad, pars[1]));
+        }
+        // Unchanged shapes are found in cache: amplitude steps do not trigger a new convolution
+        fConvTables[vIdx] = GetConvTable(vIdx, pars[1], pars[2], pars[3], fConvCache);
     }
 }
@@ -4,13 +4,24 @@
 
 #include "Fit/FitUtil.h"
 
+#include "FitKernels.h"
 #include "PhysColors.h"
 
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstddef>
 #include <ios>
 #include <iostream>
+#include <limits>
+#include <memory>
+#include <vector>
 
-double Fitters::Objective::DoEvalSigma(double nexp, double nfit) const
+double Fitters::Objective::DoEvalSigma(unsigned int i, double nexp, double nfit) const
 {
+    // Errors given with data take precedence, if valid (empty bins of a histogram have error 0)
+    if(fData->HasErrors() && fData->GetErrors()[i] > 0)
+        return fData->GetErrors()[i];
     double sigma {};
     if(nexp == 0)
         sigma = 1.84;
@@ -32,32 +43,181 @@ double Fitters::Objective::DoEvalSigma(double nexp, double nfit) const
 
 double Fitters::Objective::DoEval(const double* p) const
 {
+    ScopedTimer timer {fStats ? &fStats->fTotalTime : nullptr};
+    if(fStats)
+        fStats->fNFCN++;
     // Pre-compute convolution splines if needed (only for voigts with gamma funcs)
-    fModel->TriggerConvolution(p, fData->GetXLow(), fData->GetXUp());
+    TriggerConvolution(p);
+    return DoEvalChunks(p);
+}
+
+double Fitters::Objective::DoEvalChunks(const double* p) const
+{
+    PrepareGrids();
+    auto size {fData->GetSize()};
+    auto nchunks {(size + fChunkSize - 1) / fChunkSize};
+    fPartial.assign(nchunks, 0);
+    ScopedTimer timer {fStats ? &fStats->fModelTime : nullptr};
+    auto chunk {[&](std::size_t c)
+                {
+                    unsigned int begin {static_cast<unsigned int>(c * fChunkSize)};
+                    unsigned int end {std::min(size, begin + fChunkSize)};
+                    EvalModelRange(p, begin, end);
+                    fPartial[c] = FCNRange(begin, end);
+                }};
+    // Same chunks with or without pool, so the FCN does not depend on the number of threads
+    if(fPool)
+        fPool->Run(nchunks, chunk);
+    else
+        for(std::size_t c = 0; c < nchunks; c++)
+            chunk(c);
+    // Reduce in chunk order
+    double res {};
+    for(const auto& partial : fPartial)
+        res += partial;
+    return res;
+}
+
+double Fitters::Objective::FCNRange(unsigned int begin, unsigned int end) const
+{
+    if(fUseLikelihood)
+        return LikelihoodRange(begin, end);
+    return Chi2Range(begin, end);
+}
+
+double Fitters::Objective::LikelihoodRange(unsigned int begin, unsigned int end) const
+{
+    // Baker-Cousins: 2 sum [f - y + y ln(y / f)], with y ln(y) - y precomputed in Data
+    // Non-positive f is clamped in the log, which acts as a penalty when y > 0
+    // Negative f enters as |f|: in empty bins, the FCN would be unbounded below otherwise
+    Kernels::Log(fYFit.data() + begin, end - begin, fLogFit.data() + begin);
+    const auto* y {fData->GetY()};
+    const auto* ylogy {fData->GetYLogY()};
+    const auto* w {fData->GetWeights()};
+    double res {};
+    for(unsigned int i = begin; i < end; i++)
+        res += (w ? w[i] : 1) * (std::abs(fYFit[i]) - y[i] * fLogFit[i] + ylogy[i]);
+    return 2 * res;
+}
 
-    // Do a chi2 fit
+double Fitters::Objective::Chi2Range(unsigned int begin, unsigned int end) const
+{
     double res {};
-    for(int i = 0, size = fData->GetSize(); i < size; i++)
+    for(unsigned int i = begin; i < end; i++)
     {
-        auto x {fData->GetX(i)};
         auto yexp {fData->GetY(i)};
-        double yfit {};
-        if(fUseIntegral)
-            yfit = DoEvalWithIntegral(i, p);
-        else if(fUseDivisions)
-            yfit = DoEvalWithDivisions(x, p);
-        else
-            yfit = (*fModel)(&x, p);
+        auto yfit {fYFit[i]};
         // Numerator of Chi2 func
         auto diff {yexp - yfit};
         // Compute sigma
-        auto sigma {DoEvalSigma(yexp, yfit)};
+        auto sigma {DoEvalSigma(i, yexp, yfit)};
         // Chi2 value!
-        res += TMath::Power(diff / sigma, 2);
+        res += BinWeight(i) * TMath::Power(diff / sigma, 2);
     }
     return res;
 }
 
+void Fitters::Objective::EvalModel(const double* p) const
+{
+    PrepareGrids();
+    ScopedTimer timer {fStats ? &fStats->fModelTime : nullptr};
+    for(unsigned int begin = 0, size = fData->GetSize(); begin < size; begin += fChunkSize)
+        EvalModelRange(p, begin, std::min(size, begin + fChunkSize));
+}
+
+void Fitters::Objective::TriggerConvolution(const double* p) const
+{
+    if(!fStats)
+    {
+        fModel->TriggerConvolution(p, fData->GetXLow(), fData->GetXUp());
+        return;
+    }
+    ScopedTimer timer {&fStats->fConvTime};
+    auto before {fModel->GetNConvolutions()};
+    fModel->TriggerConvolution(p, fData->GetXLow(), fData->GetXUp());
+    fStats->fNConvolutions += fModel->GetNConvolutions() - before;
+}
+
+void Fitters::Objective::EvalComponents(const double* x, std::size_t n, const double* p, double* out) const
+{
+    if(!fStats || fPool)
+    {
+        fModel->EvalBatch(x, n, p, out);
+        return;
+    }
+    std::fill(out, out + n, 0.);
+    const auto& comps {fModel->GetComponents()};
+    for(unsigned int c = 0; c < comps.size(); c++)
+    {
+        ScopedTimer timer {ComponentTimer(c)};
+        fModel->EvalComponentBatch(comps[c], x, n, p, out);
+    }
+}
+
+void Fitters::Objective::SetUseStats(bool use)
+{
+    if(!use)
+    {
+        fStats.reset();
+        return;
+    }
+    fStats = std::make_shared<FitStats>();
+    for(const auto& comp : fModel->GetComponents())
+        fStats->fComponents.push_back(fModel->GetComponentLabel(comp));
+    fStats->fComponentTime.assign(fStats->fComponents.size(), 0);
+}
+
+void Fitters::Objective::PrepareGrids() const
+{
+    // Shared buffers are sized before any (possibly parallel) evaluation on a range of bins
+    fYFit.resize(fData->GetSize());
+    if(fUseLikelihood)
+        fLogFit.resize(fData->GetSize());
+    if(fUseIntegral)
+        return;
+    bool divisions {fUseDivisions};
+    if(fUseBinAverage)
+    {
+        fScratch.resize(Model::GetBinAverageScratch(fData->GetSize()));
+        // Divisions only for components without closed form, if enabled (bin centres otherwise)
+        const auto& comps {fModel->GetComponents()};
+        divisions = fUseDivisions &&
+                    std::any_of(comps.begin(), comps.end(),
+                                [this](const Model::Component& comp) { return !fModel->HasBinAverage(comp); });
+    }
+    if(!divisions)
+    {
+        // Phase spaces are sampled once on the grid they are evaluated on (no array of centres if uniform)
+        if(fData->IsUniform())
+            fModel->SamplePS(fData->GetX(0), fData->GetBinWidth(), fData->GetSize());
+        else
+            fModel->SamplePS(fData->GetX(), fData->GetSize());
+        return;
+    }
+    BuildDivisions();
+    fYDiv.resize(fXDiv.size());
+    fModel->SamplePS(fXDiv.data(), fXDiv.size());
+}
+
+void Fitters::Objective::EvalModelRange(const double* p, unsigned int begin, unsigned int end) const
+{
+    if(fUseIntegral)
+    {
+        for(unsigned int i = begin; i < end; i++)
+            fYFit[i] = DoEvalWithIntegral(i, p);
+    }
+    else if(fUseBinAverage)
+        DoEvalWithBinAverage(p, begin, end);
+    else if(fUseDivisions)
+        DoEvalWithDivisions(p, begin, end);
+    else
+    {
+        std::array<double, fChunkSize> x;
+        fData->FillX(begin, end, x.data());
+        EvalComponents(x.data(), end - begin, p, fYFit.data() + begin);
+    }
+}
+
 double Fitters::Objective::DoEvalWithIntegral(int i, const double* p) const
 {
     ROOT::Fit::FitUtil::IntegralEvaluator<> ig {*fModel, p};
@@ -66,34 +226,233 @@ double Fitters::Objective::DoEvalWithIntegral(int i, const double* p) const
     return ig(&low, &up);
 }
 
-double Fitters::Objective::DoEvalWithDivisions(double x, const double* p) const
+void Fitters::Objective::BuildDivisions() const
 {
-    // Unpack parameters (once per call)
-    auto pack = fModel->UnpackParameters(p);
-    auto gaus = pack[0];
-    auto voigt = pack[1];
-    auto phase = pack[2];
-    auto cte = pack[3];
-    // Define steps
-    double start {x - 0.5 * fData->GetBinWidth()};
-    double step {fData->GetBinWidth() / fNdiv};
-    double sum {};
-    for(int i = 0; i < fNdiv; i++)
+    auto size {fData->GetSize()};
+    std::size_t ndiv = fNdiv;
+    // Grid of divisions is built once and reused in every call
+    if(fXDiv.size() == size * ndiv)
+        return;
+    fXDiv.resize(size * ndiv);
+    for(unsigned int i = 0; i < size; i++)
     {
+        // Define steps in each bin, which may have variable width
+        double start {fData->GetXLowEdge(i)};
+        double step {fData->GetBinWidth(i) / fNdiv};
         // Center of division (index + 0.5)
-        double xi {start + (i + 0.5) * step};
-        sum += fModel->EvalWithPacks(xi, gaus, voigt, phase, cte);
+        for(std::size_t j = 0; j < ndiv; j++)
+            fXDiv[i * ndiv + j] = start + (j + 0.5) * step;
     }
-    // Get mean
-    sum /= fNdiv;
-    return sum;
 }
 
-void Fitters::Objective::Print() const
+void Fitters::Objective::AverageDivisions(unsigned int begin, unsigned int end) const
+{
+    // Adds mean of divisions in each bin to fYFit
+    std::size_t ndiv = fNdiv;
+    for(unsigned int i = begin; i < end; i++)
+    {
+        double sum {};
+        for(std::size_t j = 0; j < ndiv; j++)
+            sum += fYDiv[i * ndiv + j];
+        fYFit[i] += sum / fNdiv;
+    }
+}
+
+void Fitters::Objective::DoEvalWithDivisions(const double* p, unsigned int begin, unsigned int end) const
+{
+    std::size_t ndiv = fNdiv;
+    EvalComponents(fXDiv.data() + begin * ndiv, (end - begin) * ndiv, p, fYDiv.data() + begin * ndiv);
+    // Get mean in each bin
+    std::fill(fYFit.begin() + begin, fYFit.begin() + end, 0.);
+    AverageDivisions(begin, end);
+}
+
+void Fitters::Objective::DoEvalWithBinAverage(const double* p, unsigned int begin, unsigned int end) const
+{
+    std::fill(fYFit.begin() + begin, fYFit.begin() + end, 0.);
+    std::array<double, fChunkSize + 1> edges;
+    fData->FillEdges(begin, end, edges.data());
+    bool anyDiv {};
+    const auto& comps {fModel->GetComponents()};
+    for(unsigned int c = 0; c < comps.size(); c++)
+    {
+        if(fModel->HasBinAverage(comps[c]))
+        {
+            ScopedTimer timer {ComponentTimer(c)};
+            fModel->EvalComponentBinAverage(comps[c], edges.data(), end - begin, p, fYFit.data() + begin,
+                                            fScratch.data() + Model::GetBinAverageScratch(begin));
+        }
+        else
+            anyDiv = true;
+    }
+    if(!anyDiv)
+        return;
+    // Components without closed form are subsampled in divisions if enabled, evaluated at bin centres otherwise
+    if(!fUseDivisions)
+    {
+        std::array<double, fChunkSize> x;
+        fData->FillX(begin, end, x.data());
+        for(unsigned int c = 0; c < comps.size(); c++)
+        {
+            if(fModel->HasBinAverage(comps[c]))
+                continue;
+            ScopedTimer timer {ComponentTimer(c)};
+            fModel->EvalComponentBatch(comps[c], x.data(), end - begin, p, fYFit.data() + begin);
+        }
+        return;
+    }
+    std::size_t ndiv = fNdiv;
+    std::fill(fYDiv.begin() + begin * ndiv, fYDiv.begin() + end * ndiv, 0.);
+    for(unsigned int c = 0; c < comps.size(); c++)
+    {
+        if(fModel->HasBinAverage(comps[c]))
+            continue;
+        ScopedTimer timer {ComponentTimer(c)};
+        fModel->EvalComponentBatch(comps[c], fXDiv.data() + begin * ndiv, (end - begin) * ndiv, p,
+                                   fYDiv.data() + begin * ndiv);
+    }
+    AverageDivisions(begin, end);
+}
+
+Fitters::Objective Fitters::Objective::CloneDetached() const
+{
+    Objective ret {*this};
+    ret.fModel.reset(dynamic_cast<Model*>(fModel->Clone()));
+    ret.fPool.reset();
+    // Counters of its own: workers do not add to those of this one
+    if(fStats)
+        ret.SetUseStats(true);
+    return ret;
+}
+
+void Fitters::Objective::SetData(const std::shared_ptr<Data>& data)
+{
+    bool sameBins {fData && data && fData->GetSize() == data->GetSize()};
+    for(unsigned int i = 0; sameBins && i <= data->GetSize(); i++)
+        sameBins = fData->GetXLowEdge(i) == data->GetXLowEdge(i);
+    fData = data;
+    // Divisions are cached by size only: drop them for a different binning (phase spaces are matched by value)
+    if(!sameBins)
+    {
+        fXDiv.clear();
+        fYDiv.clear();
+    }
+}
+
+void Fitters::Objective::SetNThreads(unsigned int n)
+{
+    if(n > 1)
+        fPool = std::make_shared<ThreadPool>(n);
+    else
+        fPool.reset();
+}
+
+void Fitters::Objective::Gradient(const double* p, double* grad) const
+{
+    auto npar {NDim()};
+    std::fill(grad, grad + npar, 0.);
+    // ROOT integrator has no derivative form (its FCN calls are counted as such)
+    if(fUseIntegral)
+    {
+        DoNumericalGradient(p, grad);
+        return;
+    }
+    ScopedTimer timer {fStats ? &fStats->fTotalTime : nullptr};
+    if(fStats)
+        fStats->fNGradient++;
+    TriggerConvolution(p);
+    EvalModel(p);
+    // d chi2 / d yfit, with sigma taken as constant within its current branch
+    // For likelihood, d/df of 2 [|f| - y ln f] = 2 (sign(f) - y / f)
+    auto size {fData->GetSize()};
+    fDChi2.resize(size);
+    for(unsigned int i = 0; i < size; i++)
+    {
+        auto yexp {fData->GetY(i)};
+        if(fUseLikelihood)
+        {
+            fDChi2[i] = 2 * BinWeight(i) *
+                        ((fYFit[i] < 0 ? -1 : 1) -
+                         ((yexp > 0) ? yexp / std::max(fYFit[i], std::numeric_limits<double>::min()) : 0));
+            continue;
+        }
+        auto sigma {DoEvalSigma(i, yexp, fYFit[i])};
+        fDChi2[i] = -2 * BinWeight(i) * (yexp - fYFit[i]) / (sigma * sigma);
+    }
+    for(const auto& comp : fModel->GetComponents())
+    {
+        // Grid on which this component is evaluated: bins, bin averages or divisions averaged per bin
+        bool average {fUseBinAverage && fModel->HasBinAverage(comp)};
+        bool divisions {!average && fUseDivisions};
+        if(divisions)
+            BuildDivisions();
+        std::size_t ndiv = divisions ? fNdiv : 1;
+        std::size_t n {size * ndiv};
+        fRows.resize(comp.fNPar * n);
+        std::array<double*, 4> rows {};
+        for(unsigned int k = 0; k < comp.fNPar; k++)
+            rows[k] = IsFixed(comp.fOffset + k) ? nullptr : fRows.data() + k * n;
+        if(average)
+            fModel->EvalComponentBinAverageGrad(comp, fData->GetEdges(), size, p, rows.data(), fScratch.data());
+        else
+            fModel->EvalComponentGradBatch(comp, divisions ? fXDiv.data() : fData->GetX(), n, p, rows.data());
+        for(unsigned int k = 0; k < comp.fNPar; k++)
+        {
+            if(!rows[k])
+                continue;
+            double sum {};
+            for(unsigned int i = 0; i < size; i++)
+            {
+                double deriv {};
+                for(std::size_t j = 0; j < ndiv; j++)
+                    deriv += rows[k][i * ndiv + j];
+                sum += fDChi2[i] * deriv / ndiv;
+            }
+            grad[comp.fOffset + k] = sum;
+        }
+    }
+}
+
+double Fitters::Objective::DoDerivative(const double* p, unsigned int icoord) const
+{
+    fGrad.resize(NDim());
+    Gradient(p, fGrad.data());
+    return fGrad[icoord];
+}
+
+void Fitters::Objective::DoNumericalGradient(const double* p, double* grad) const
+{
+    std::vector<double> pars(p, p + NDim());
+    for(unsigned int k = 0, size = pars.size(); k < size; k++)
+    {
+        if(IsFixed(k))
+            continue;
+        double h {1e-6 * std::max(std::abs(p[k]), 1e-3)};
+        pars[k] = p[k] + h;
+        double up {DoEval(pars.data())};
+        pars[k] = p[k] - h;
+        double down {DoEval(pars.data())};
+        pars[k] = p[k];
+        grad[k] = (up - down) / (2 * h);
+    }
+}
+
+void Fitters::Objective::Expected(const double* p, double* out) const
+{
+    fModel->TriggerConvolution(p, fData->GetXLow(), fData->GetXUp());
+    EvalModel(p);
+    std::copy(fYFit.begin(), fYFit.end(), out);
+}
+
+void Fitters::Objective::Print(std::ostream& out) const
 {
-    std::cout << BOLDGREEN << "---- Objective func settings ----" << '\n';
-    std::cout << "-> UseDivisions ? " << std::boolalpha << fUseDivisions << '\n';
-    std::cout << "-> Ndiv         : " << fNdiv << '\n';
-    std::cout << "-> UseIntegral ? " << std::boolalpha << fUseIntegral << '\n';
-    std::cout << "------------------------------" << RESET << '\n';
+    out << BOLDGREEN << "---- Objective func settings ----" << '\n';
+    out << "-> UseDivisions ? " << std::boolalpha << fUseDivisions << '\n';
+    out << "-> Ndiv         : " << fNdiv << '\n';
+    out << "-> UseIntegral ? " << std::boolalpha << fUseIntegral << '\n';
+    out << "-> UseBinAverage ? " << std::boolalpha << fUseBinAverage << '\n';
+    out << "-> UseLikelihood ? " << std::boolalpha << fUseLikelihood << '\n';
+    out << "-> NThreads     : " << GetNThreads() << '\n';
+    out << "-> UseStats     ? " << std::boolalpha << static_cast<bool>(fStats) << '\n';
+    out << "------------------------------" << RESET << '\n';
 }
@@ -2,19 +2,154 @@
 
 #include "TFile.h"
 #include "TFitResult.h"
+#include "TGraph.h"
+#include "TGraph2D.h"
+#include "TROOT.h"
 
+#include "FitThreadPool.h"
+#include "PhysColors.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <functional>
 #include <iostream>
+#include <map>
 #include <memory>
+#include <numeric>
+#include <random>
+#include <stdexcept>
 #include <string>
+#include <tuple>
+#include <utility>
 #include <vector>
 
+namespace
+{
+// Uniform in [0, 1) from the 53 high bits of the engine: portable, unlike std distributions
+double Uniform(std::mt19937_64& engine)
+{
+    return (engine() >> 11) * 0x1.0p-53;
+}
+
+// Poisson deviate: multiplication method for small means, transformed rejection (PTRS, Hormann 1993) otherwise
+double Poisson(std::mt19937_64& engine, double mean)
+{
+    if(!(mean > 0))
+        return 0;
+    if(mean < 10)
+    {
+        double limit {std::exp(-mean)};
+        double prod {Uniform(engine)};
+        double k {};
+        while(prod > limit)
+        {
+            prod *= Uniform(engine);
+            k++;
+        }
+        return k;
+    }
+    double slam {std::sqrt(mean)};
+    double loglam {std::log(mean)};
+    double b {0.931 + 2.53 * slam};
+    double a {-0.059 + 0.02483 * b};
+    double invalpha {1.1239 + 1.1328 / (b - 3.4)};
+    double vr {0.9277 - 3.6224 / (b - 2)};
+    while(true)
+    {
+        double u {Uniform(engine) - 0.5};
+        double v {Uniform(engine)};
+        double us {0.5 - std::abs(u)};
+        double k {std::floor((2 * a / us + b) * u + mean + 0.43)};
+        if(us >= 0.07 && v <= vr)
+            return k;
+        if(k < 0 || (us < 0.013 && v > us))
+            continue;
+        if(std::log(v) + std::log(invalpha) - std::log(a / (us * us) + b) <= -mean + k * loglam - std::lgamma(k + 1))
+            return k;
+    }
+}
+
+// Central interval of the valid values at confidence level cl, linear interpolation between order statistics
+std::pair<double, double> Percentiles(const std::vector<double>& values, const std::vector<bool>& valid, double cl)
+{
+    std::vector<double> sorted {};
+    for(std::size_t i = 0; i < values.size(); i++)
+        if(i < valid.size() && valid[i])
+            sorted.push_back(values[i]);
+    if(sorted.empty())
+        throw std::runtime_error("Runner::BootstrapStats: no valid replicas");
+    std::sort(sorted.begin(), sorted.end());
+    auto quantile {[&](double q)
+                   {
+                       double pos {q * (sorted.size() - 1)};
+                       auto i {static_cast<std::size_t>(pos)};
+                       if(i + 1 >= sorted.size())
+                           return sorted.back();
+                       return sorted[i] + (pos - i) * (sorted[i + 1] - sorted[i]);
+                   }};
+    return {quantile((1 - cl) / 2), quantile((1 + cl) / 2)};
+}
+} // namespace
+
+std::pair<double, double> Fitters::Runner::BootstrapStats::ParInterval(unsigned int ipar, double cl) const
+{
+    DoubleVec values {};
+    for(const auto& pars : fParams)
+        values.push_back(ipar < pars.size() ? pars[ipar] : 0);
+    return Percentiles(values, fValid, cl);
+}
+
+std::pair<double, double> Fitters::Runner::BootstrapStats::CountsInterval(const std::string& key, double cl) const
+{
+    if(!fCounts.count(key))
+        throw std::runtime_error("Runner::BootstrapStats::CountsInterval(): no counts for " + key);
+    return Percentiles(fCounts.at(key), fValid, cl);
+}
+
+Fitters::Runner::DoubleVec Fitters::Runner::ToyStats::Pulls(unsigned int ipar) const
+{
+    DoubleVec ret {};
+    for(std::size_t r = 0; r < fParams.size(); r++)
+        if(fValid[r] && ipar < fErrors[r].size() && fErrors[r][ipar] > 0)
+            ret.push_back((fParams[r][ipar] - fTruth[ipar]) / fErrors[r][ipar]);
+    return ret;
+}
+
 void Fitters::Runner::SetFCN()
+{
+    SetFCN(fFitter, fObj);
+}
+
+void Fitters::Runner::SetFCN(ROOT::Fit::Fitter& fitter, const Objective& obj) const
 {
     // Toy double pars[NDim] that just serve as initialization
-    std::vector<double> pars(fObj.NDim(), 0);
+    // Once settings exist, pass nullptr so they are kept
+    std::vector<double> pars(obj.NDim(), 0);
+    const double* init {fitter.Config().ParamsSettings().empty() ? pars.data() : nullptr};
     // Objective func is managed by us
     // But model func is cloned when set
-    fFitter.SetFCN(fObj, *(fObj.GetModel()), &(pars.front()), fObj.GetData()->GetSize(), true);
+    // The gradient is offered through the type (older ROOT) and HasGradient() (newer ROOT)
+    if(obj.HasGradient())
+        fitter.SetFCN(static_cast<const ROOT::Math::IMultiGradFunction&>(obj), *(obj.GetModel()), init,
+                      obj.GetData()->GetSize(), true);
+    else
+        fitter.SetFCN(static_cast<const ROOT::Math::IMultiGenFunction&>(obj), *(obj.GetModel()), init,
+                      obj.GetData()->GetSize(), true);
+}
+
+void Fitters::Runner::SetUseStats(bool use)
+{
+    fObj.SetUseStats(use);
+    SetFCN();
+}
+
+void Fitters::Runner::SetUseGradient(bool use)
+{
+    fUseGradient = use;
+    fObj.SetUseGradient(use);
+    SetFCN();
 }
 
 void Fitters::Runner::SetInitial(const Init& pars)
@@ -78,12 +213,53 @@ bool Fitters::Runner::Fit(bool print, bool hesse, bool minos)
     // Print settings
     if(print)
     {
-        fFitter.Config().MinimizerOptions().Print();
-        fObj.GetModel()->Print();
-        fObj.Print();
+        fFitter.Config().MinimizerOptions().Print(*fOut);
+        fObj.GetModel()->Print(*fOut);
+        fObj.Print(*fOut);
+    }
+    // Counters refer to this call only
+    if(auto stats {fObj.GetStats()})
+        stats->Reset();
+    // Derivatives of fixed parameters are not needed
+    if(fUseGradient)
+    {
+        std::vector<bool> fixed {};
+        for(const auto& par : fFitter.Config().ParamsSettings())
+            fixed.push_back(par.IsFixed());
+        fObj.SetFixedPars(fixed);
+    }
+    // Perform fit, or reuse the last minimum if asked and nothing it depends on changed
+    auto signature {ConfigSignature()};
+    bool reuse {fUseWarmStart && fReuseMinimum && fHasLast && signature == fLastConfig};
+    // Step sizes set by the user, restored after a warm-started fit
+    DoubleVec steps {};
+    if(fUseWarmStart && fHasLast && !reuse)
+        steps = WarmStart();
+    bool ret {};
+    if(reuse)
+    {
+        // Fitter keeps its minimizer and result: only HESSE/MINOS below are run if asked
+        if(print)
+            *fOut << "Fitters::Runner::Fit(): configuration unchanged, reusing last minimum" << '\n';
+        ret = fLastValid;
+    }
+    else
+    {
+        // Set again so the fitter sees the latest state of the objective
+        SetFCN();
+        ret = fFitter.FitFCN();
+        auto& settings {fFitter.Config().ParamsSettings()};
+        for(std::size_t p = 0; p < steps.size() && p < settings.size(); p++)
+            settings[p].SetStepSize(steps[p]);
+        fLastPars = fFitter.Result().Parameters();
+        fLastErrors = fFitter.Result().Errors();
+        fLastConfig = signature;
+        fLastValid = ret;
+        fHasLast = true;
+        // Scans refer to the previous minimum
+        fProfiles.clear();
+        fProfiles2D.clear();
     }
-    // Perform fit
-    auto ret {fFitter.FitFCN()};
     if(hesse)
     {
         // In principle, Minuit2 with strategy=1 automatically calls Hesse after minimum if found
@@ -91,19 +267,641 @@ bool Fitters::Runner::Fit(bool print, bool hesse, bool minos)
         // Minimum differences between calls are found, idk why... Maybe numeric precision errors?
         // https://root-forum.cern.ch/t/errors-given-by-root-minuit2minimizer-are-confusing/57166/2
         if(print)
-            std::cout << "Fitters::Runner::Fit(): calling HESSIAN after MIGRAD" << '\n';
+            *fOut << "Fitters::Runner::Fit(): calling HESSIAN after MIGRAD" << '\n';
         fFitter.CalculateHessErrors();
     }
-    if(minos)
+    if(minos && fNThreadsMinos <= 1)
         fFitter.CalculateMinosErrors();
+    fResult = fFitter.Result();
+    if(minos && fNThreadsMinos > 1)
+        ParallelMinos();
     // Print
     if(print)
-        fFitter.Result().Print(std::cout);
+    {
+        fResult.Print(*fOut);
+        if(auto stats {fObj.GetStats()})
+            stats->Print(*fOut);
+    }
     // Check parameters at limit
     ParametersAtLimit();
     return ret;
 }
 
+std::vector<Fitters::Runner::DoubleVec> Fitters::Runner::SampleStarts(unsigned int nstarts, unsigned long seed,
+                                                                     StartMode mode) const
+{
+    const auto& settings {fFitter.Config().ParamsSettings()};
+    auto npar {settings.size()};
+    // Engine with portable output; uniforms and permutations are built from it by hand, as std distributions
+    // are implementation-defined
+    std::mt19937_64 engine {seed};
+    auto uniform {[&]() { return Uniform(engine); }};
+    // Position in [0, 1) of each start and parameter
+    std::vector<DoubleVec> unit(nstarts, DoubleVec(npar));
+    for(std::size_t p = 0; p < npar; p++)
+    {
+        if(mode == StartMode::kLatinHypercube)
+        {
+            // One start per stratum of each parameter, strata shuffled independently (Fisher-Yates)
+            std::vector<unsigned int> strata(nstarts);
+            std::iota(strata.begin(), strata.end(), 0);
+            for(std::size_t i = nstarts; i > 1; i--)
+                std::swap(strata[i - 1], strata[engine() % i]);
+            for(unsigned int s = 0; s < nstarts; s++)
+                unit[s][p] = (strata[s] + uniform()) / nstarts;
+        }
+        else
+            for(unsigned int s = 0; s < nstarts; s++)
+                unit[s][p] = uniform();
+    }
+    std::vector<DoubleVec> ret(nstarts, DoubleVec(npar));
+    for(unsigned int s = 0; s < nstarts; s++)
+    {
+        for(std::size_t p = 0; p < npar; p++)
+        {
+            const auto& par {settings[p]};
+            // Start 0 is the configured initial point
+            if(s == 0 || par.IsFixed() || !par.IsDoubleBound())
+                ret[s][p] = par.Value();
+            else
+                ret[s][p] = par.LowerLimit() + unit[s][p] * (par.UpperLimit() - par.LowerLimit());
+        }
+    }
+    return ret;
+}
+
+bool Fitters::Runner::FitMultiStart(unsigned int nstarts, unsigned int nthreads, unsigned long seed,
+                                    StartMode mode, bool print, bool hesse, bool minos)
+{
+    if(nstarts == 0)
+        throw std::runtime_error("Runner::FitMultiStart(): nstarts must be > 0");
+    // Derivatives of fixed parameters are not needed
+    if(fUseGradient)
+    {
+        std::vector<bool> fixed {};
+        for(const auto& par : fFitter.Config().ParamsSettings())
+            fixed.push_back(par.IsFixed());
+        fObj.SetFixedPars(fixed);
+    }
+    fMultiStart = {};
+    fMultiStart.fStarts = SampleStarts(nstarts, seed, mode);
+    fMultiStart.fParams.resize(nstarts);
+    fMultiStart.fMinima.assign(nstarts, 0);
+    // std::vector<bool> cannot be written concurrently
+    std::vector<char> valid(nstarts);
+    nthreads = std::max(1u, std::min(nthreads, nstarts));
+    if(nthreads > 1)
+        ROOT::EnableThreadSafety();
+    // Independent objective, model and fitter for each start
+    // Built here, serially, because cloning a model copies ROOT objects
+    std::vector<Objective> objs {};
+    std::vector<std::unique_ptr<ROOT::Fit::Fitter>> fitters {};
+    for(unsigned int s = 0; s < nstarts; s++)
+        objs.push_back(fObj.CloneDetached());
+    for(unsigned int s = 0; s < nstarts; s++)
+        fitters.push_back(MakeWorkerFitter(objs[s], fMultiStart.fStarts[s]));
+    ThreadPool pool {nthreads};
+    pool.Run(nstarts,
+             [&](std::size_t s)
+             {
+                 valid[s] = fitters[s]->FitFCN();
+                 fMultiStart.fMinima[s] = fitters[s]->Result().MinFcnValue();
+                 fMultiStart.fParams[s] = fitters[s]->Result().Parameters();
+             });
+    fMultiStart.fValid.assign(valid.begin(), valid.end());
+    // Best valid minimum, lowest index on ties
+    for(unsigned int s = 0; s < nstarts; s++)
+        if(fMultiStart.fValid[s] &&
+           (fMultiStart.fBest < 0 || fMultiStart.fMinima[s] < fMultiStart.fMinima[fMultiStart.fBest]))
+            fMultiStart.fBest = s;
+    // Spread of valid minima
+    double sum {};
+    double sum2 {};
+    unsigned int nvalid {};
+    for(unsigned int s = 0; s < nstarts; s++)
+    {
+        if(!fMultiStart.fValid[s])
+            continue;
+        sum += fMultiStart.fMinima[s];
+        sum2 += fMultiStart.fMinima[s] * fMultiStart.fMinima[s];
+        nvalid++;
+        if(std::abs(fMultiStart.fMinima[s] - fMultiStart.fMinima[fMultiStart.fBest]) < fMultiStart.fTolerance)
+            fMultiStart.fNAtBest++;
+    }
+    if(nvalid > 0)
+        fMultiStart.fStdDev = std::sqrt(std::max(sum2 / nvalid - (sum / nvalid) * (sum / nvalid), 0.));
+    if(print)
+        PrintMultiStart();
+    if(fMultiStart.fBest < 0)
+    {
+        *fOut << BOLDRED << "Runner::FitMultiStart(): no start converged, fitting from the initial point"
+              << RESET << '\n';
+        return Fit(print, hesse, minos);
+    }
+    // Refit from the best minimum with this runner, so that its result, errors and Write() refer to it
+    const auto& best {fMultiStart.fParams[fMultiStart.fBest]};
+    for(std::size_t p = 0; p < best.size(); p++)
+        fFitter.Config().ParSettings(p).SetValue(best[p]);
+    fHasLast = false;
+    return Fit(print, hesse, minos);
+}
+
+bool Fitters::Runner::Bootstrap(unsigned int nreplicas, unsigned int nthreads, unsigned long seed,
+                                ResampleMode mode, bool print)
+{
+    if(nreplicas == 0)
+        throw std::runtime_error("Runner::Bootstrap(): nreplicas must be > 0");
+    if(!fHasLast)
+        throw std::runtime_error("Runner::Bootstrap(): no nominal minimum, call Fit() first");
+    const auto& data {*fObj.GetData()};
+    auto size {data.GetSize()};
+    const auto* y {data.GetY()};
+    // Total and cumulative contents for multinomial sampling
+    DoubleVec cum(size + 1);
+    for(unsigned int i = 0; i < size; i++)
+        cum[i + 1] = cum[i] + std::max(y[i], 0.);
+    auto total {std::llround(cum[size])};
+    fBootstrap = {};
+    fBootstrap.fNominal = fResult.Parameters();
+    fBootstrap.fNominalCounts = ComponentCounts(fObj, fBootstrap.fNominal);
+    fBootstrap.fParams.resize(nreplicas);
+    std::vector<std::map<std::string, double>> counts(nreplicas);
+    std::vector<char> valid(nreplicas);
+    FitReplicas(
+        nreplicas, nthreads, seed,
+        [&](std::mt19937_64& engine, double* out)
+        {
+            if(mode == ResampleMode::kPoisson)
+            {
+                for(unsigned int i = 0; i < size; i++)
+                    out[i] = Poisson(engine, y[i]);
+                return;
+            }
+            std::fill(out, out + size, 0.);
+            for(long long e = 0; e < total; e++)
+            {
+                auto it {std::upper_bound(cum.begin(), cum.end(), Uniform(engine) * cum[size])};
+                out[std::min<std::size_t>(it - cum.begin(), size) - 1]++;
+            }
+        },
+        [&](std::size_t r, const Objective& obj, const ROOT::Fit::FitResult& res, bool ok)
+        {
+            valid[r] = ok;
+            fBootstrap.fParams[r] = res.Parameters();
+            counts[r] = ComponentCounts(obj, fBootstrap.fParams[r]);
+        });
+    fBootstrap.fValid.assign(valid.begin(), valid.end());
+    for(unsigned int r = 0; r < nreplicas; r++)
+        for(const auto& [key, value] : counts[r])
+            fBootstrap.fCounts[key].push_back(value);
+    if(print)
+        PrintBootstrap();
+    return std::count(valid.begin(), valid.end(), 1) > 0;
+}
+
+bool Fitters::Runner::FitToys(unsigned int ntoys, unsigned int nthreads, unsigned long seed, bool print)
+{
+    if(ntoys == 0)
+        throw std::runtime_error("Runner::FitToys(): ntoys must be > 0");
+    if(!fHasLast)
+        throw std::runtime_error("Runner::FitToys(): no fitted model to sample from, call Fit() first");
+    auto start {std::chrono::steady_clock::now()};
+    auto size {fObj.GetData()->GetSize()};
+    fToys = {};
+    fToys.fTruth = fResult.Parameters();
+    fToys.fDataMinimum = fResult.MinFcnValue();
+    // Contents expected by the fitted model, with the same bin evaluation as the objective
+    DoubleVec expected(size);
+    fObj.Expected(fToys.fTruth.data(), expected.data());
+    fToys.fParams.resize(ntoys);
+    fToys.fErrors.resize(ntoys);
+    fToys.fMinima.assign(ntoys, 0);
+    std::vector<char> valid(ntoys);
+    FitReplicas(
+        ntoys, nthreads, seed,
+        [&](std::mt19937_64& engine, double* out)
+        {
+            for(unsigned int i = 0; i < size; i++)
+                out[i] = Poisson(engine, expected[i]);
+        },
+        [&](std::size_t r, const Objective& obj, const ROOT::Fit::FitResult& res, bool ok)
+        {
+            valid[r] = ok;
+            fToys.fParams[r] = res.Parameters();
+            fToys.fErrors[r] = res.Errors();
+            fToys.fMinima[r] = res.MinFcnValue();
+        });
+    fToys.fValid.assign(valid.begin(), valid.end());
+    // Goodness of fit: fraction of valid toys with a minimum at least as large as the one of data
+    unsigned int nvalid {};
+    unsigned int nworse {};
+    for(unsigned int r = 0; r < ntoys; r++)
+    {
+        if(!fToys.fValid[r])
+            continue;
+        nvalid++;
+        if(fToys.fMinima[r] >= fToys.fDataMinimum)
+            nworse++;
+    }
+    fToys.fPValue = (nvalid > 0) ? static_cast<double>(nworse) / nvalid : -1;
+    std::chrono::duration<double> elapsed {std::chrono::steady_clock::now() - start};
+    fToys.fToysPerSecond = ntoys / elapsed.count();
+    if(print)
+        PrintToys();
+    return nvalid > 0;
+}
+
+void Fitters::Runner::FitReplicas(unsigned int nreplicas, unsigned int nthreads, unsigned long seed,
+                                  const Sampler& sample, const Collector& collect) const
+{
+    const auto& data {*fObj.GetData()};
+    auto size {data.GetSize()};
+    const auto& start {fResult.Parameters()};
+    nthreads = std::max(1u, std::min(nthreads, nreplicas));
+    if(nthreads > 1)
+        ROOT::EnableThreadSafety();
+    // Per thread: clone of objective and model, data view on a buffer of contents and fitter, all built here,
+    // serially. The fitter holds a copy of the objective sharing its data, which is replaced in place, so the
+    // buffers of the objective are reused by all the replicas of the thread
+    std::vector<Objective> objs {};
+    std::vector<std::shared_ptr<Data>> views {};
+    std::vector<DoubleVec> buffers(nthreads, DoubleVec(size));
+    std::vector<std::unique_ptr<ROOT::Fit::Fitter>> fitters {};
+    for(unsigned int t = 0; t < nthreads; t++)
+    {
+        auto& obj {objs.emplace_back(fObj.CloneDetached())};
+        obj.SetData(views.emplace_back(std::make_shared<Data>(data)));
+    }
+    for(unsigned int t = 0; t < nthreads; t++)
+    {
+        auto& fitter {fitters.emplace_back(MakeWorkerFitter(objs[t], start))};
+        for(std::size_t p = 0; p < fResult.Errors().size(); p++)
+            if(fResult.Errors()[p] > 0)
+                fitter->Config().ParSettings(p).SetStepSize(fResult.Errors()[p]);
+    }
+    ThreadPool pool {nthreads};
+    pool.Run(nthreads,
+             [&](std::size_t t)
+             {
+                 auto& fitter {*fitters[t]};
+                 auto& buffer {buffers[t]};
+                 for(std::size_t r = t * nreplicas / nthreads; r < (t + 1) * nreplicas / nthreads; r++)
+                 {
+                     std::seed_seq seq {seed & 0xffffffffUL, seed >> 32, static_cast<unsigned long>(r)};
+                     std::mt19937_64 engine {seq};
+                     sample(engine, buffer.data());
+                     // Same bins, errors and weights as data, contents viewed in the buffer of the thread
+                     *views[t] = Data {Data::View {}, data, buffer.data()};
+                     // Every replica starts from the last minimum
+                     for(std::size_t p = 0; p < start.size(); p++)
+                         fitter.Config().ParSettings(p).SetValue(start[p]);
+                     bool ok {fitter.FitFCN()};
+                     collect(r, objs[t], fitter.Result(), ok);
+                 }
+             });
+}
+
+std::map<std::string, double> Fitters::Runner::ComponentCounts(const Objective& obj, const DoubleVec& pars) const
+{
+    // Integrated over the fit range in units of the bin width, as the counts of Angular::Fitter
+    auto model {obj.GetModel()};
+    auto data {obj.GetData()};
+    std::map<std::string, double> ret {};
+    for(const auto& comp : model->GetComponents())
+    {
+        if(comp.fType != Model::FuncType::kGauss && comp.fType != Model::FuncType::kVoigt)
+            continue;
+        ret[model->GetComponentLabel(comp)] =
+            model->IntegralComponent(comp, pars.data(), data->GetXLow(), data->GetXUp()) / data->GetBinWidth();
+    }
+    return ret;
+}
+
+void Fitters::Runner::PrintBootstrap() const
+{
+    const auto& bs {fBootstrap};
+    auto nvalid {std::count(bs.fValid.begin(), bs.fValid.end(), true)};
+    *fOut << BOLDGREEN << "---- Fitters::Runner bootstrap ----" << '\n';
+    *fOut << "-> NReplicas : " << bs.fParams.size() << '\n';
+    *fOut << "-> NValid    : " << nvalid << '\n';
+    if(nvalid > 0)
+    {
+        for(unsigned int p = 0; p < bs.fNominal.size(); p++)
+        {
+            if(fFitter.Config().ParSettings(p).IsFixed())
+                continue;
+            auto [low, up] {bs.ParInterval(p)};
+            *fOut << "   " << fObj.GetModel()->ParameterName(p) << " : " << bs.fNominal[p] << " [" << low << ", "
+                  << up << "]" << '\n';
+        }
+        for(const auto& [key, nominal] : bs.fNominalCounts)
+        {
+            auto [low, up] {bs.CountsInterval(key)};
+            *fOut << "   " << key << " counts : " << nominal << " [" << low << ", " << up << "]" << '\n';
+        }
+    }
+    *fOut << "-----------------------------------" << RESET << '\n';
+}
+
+void Fitters::Runner::PrintToys() const
+{
+    const auto& ts {fToys};
+    *fOut << BOLDGREEN << "---- Fitters::Runner toys ----" << '\n';
+    *fOut << "-> NToys      : " << ts.fMinima.size() << '\n';
+    *fOut << "-> NValid     : " << std::count(ts.fValid.begin(), ts.fValid.end(), true) << '\n';
+    *fOut << "-> Toys/s     : " << ts.fToysPerSecond << '\n';
+    *fOut << "-> FCN (data) : " << ts.fDataMinimum << '\n';
+    *fOut << "-> p-value    : " << ts.fPValue << '\n';
+    // Mean and standard deviation of pulls: 0 and 1 for unbiased estimates with correct errors
+    for(unsigned int p = 0; p < ts.fTruth.size(); p++)
+    {
+        if(fFitter.Config().ParSettings(p).IsFixed())
+            continue;
+        auto pulls {ts.Pulls(p)};
+        if(pulls.empty())
+            continue;
+        double mean {std::accumulate(pulls.begin(), pulls.end(), 0.) / pulls.size()};
+        double var {};
+        for(auto pull : pulls)
+            var += (pull - mean) * (pull - mean);
+        *fOut << "   pull " << fObj.GetModel()->ParameterName(p) << " : mean = " << mean
+              << ", sigma = " << std::sqrt(var / pulls.size()) << '\n';
+    }
+    *fOut << "------------------------------" << RESET << '\n';
+}
+
+std::unique_ptr<ROOT::Fit::Fitter> Fitters::Runner::MakeWorkerFitter(const Objective& obj,
+                                                                    const DoubleVec& values) const
+{
+    auto ret {std::make_unique<ROOT::Fit::Fitter>()};
+    ret->Config() = fFitter.Config();
+    for(std::size_t p = 0; p < values.size(); p++)
+        ret->Config().ParSettings(p).SetValue(values[p]);
+    ret->Config().MinimizerOptions().SetPrintLevel(0);
+    SetFCN(*ret, obj);
+    return ret;
+}
+
+void Fitters::Runner::ParallelMinos()
+{
+    // Parameters requested in the config, or all free ones
+    std::vector<unsigned int> pars {fFitter.Config().MinosParams()};
+    if(pars.empty())
+        for(unsigned int p = 0; p < fResult.Parameters().size(); p++)
+            if(!fFitter.Config().ParSettings(p).IsFixed())
+                pars.push_back(p);
+    if(pars.empty())
+        return;
+    auto nthreads {std::max(1u, std::min<unsigned int>(fNThreadsMinos, pars.size()))};
+    if(nthreads > 1)
+        ROOT::EnableThreadSafety();
+    // One clone and fitter per parameter, starting at the minimum with steps of the size of the errors
+    std::vector<Objective> objs {};
+    std::vector<std::unique_ptr<ROOT::Fit::Fitter>> fitters {};
+    for(std::size_t i = 0; i < pars.size(); i++)
+        objs.push_back(fObj.CloneDetached());
+    for(std::size_t i = 0; i < pars.size(); i++)
+    {
+        auto& fitter {fitters.emplace_back(MakeWorkerFitter(objs[i], fResult.Parameters()))};
+        for(std::size_t p = 0; p < fResult.Errors().size(); p++)
+            if(fResult.Errors()[p] > 0)
+                fitter->Config().ParSettings(p).SetStepSize(fResult.Errors()[p]);
+        fitter->Config().SetMinosErrors(std::vector<unsigned int> {pars[i]});
+    }
+    std::vector<std::pair<double, double>> errors(pars.size());
+    std::vector<char> valid(pars.size());
+    ThreadPool pool {nthreads};
+    pool.Run(pars.size(),
+             [&](std::size_t i)
+             {
+                 // MINOS needs the minimizer of a previous minimization: converges at once from the minimum
+                 if(!fitters[i]->FitFCN())
+                     return;
+                 valid[i] = fitters[i]->CalculateMinosErrors();
+                 errors[i] = {fitters[i]->Result().LowerError(pars[i]), fitters[i]->Result().UpperError(pars[i])};
+             });
+    // Merge, in parameter order
+    for(std::size_t i = 0; i < pars.size(); i++)
+    {
+        if(valid[i])
+            fResult.SetMinosError(pars[i], errors[i].first, errors[i].second);
+        else
+            *fOut << BOLDRED << "Runner::ParallelMinos(): MINOS failed for parameter "
+                  << fObj.GetModel()->ParameterName(pars[i]) << RESET << '\n';
+    }
+}
+
+std::pair<double, double> Fitters::Runner::ScanRange(unsigned int ipar, double min, double max) const
+{
+    if(ipar >= fResult.Parameters().size())
+        throw std::runtime_error("Runner::ScanRange(): parameter index out of range: " + std::to_string(ipar));
+    if(min < max)
+        return {min, max};
+    double value {fResult.Parameter(ipar)};
+    double error {fResult.Error(ipar)};
+    if(!(error > 0))
+        throw std::runtime_error("Runner::ScanRange(): no error for parameter " +
+                                 fObj.GetModel()->ParameterName(ipar) + ", pass a range");
+    min = value - 3 * error;
+    max = value + 3 * error;
+    const auto& par {fFitter.Config().ParSettings(ipar)};
+    if(par.HasLowerLimit())
+        min = std::max(min, par.LowerLimit());
+    if(par.HasUpperLimit())
+        max = std::min(max, par.UpperLimit());
+    return {min, max};
+}
+
+Fitters::Runner::DoubleVec Fitters::Runner::Profile(const std::vector<unsigned int>& pars,
+                                                    const std::vector<DoubleVec>& points,
+                                                    unsigned int nthreads) const
+{
+    if(!fHasLast)
+        throw std::runtime_error("Runner::Profile(): no minimum to profile, call Fit() first");
+    DoubleVec ret(points.size());
+    if(points.empty())
+        return ret;
+    nthreads = std::max(1u, std::min<unsigned int>(nthreads, points.size()));
+    if(nthreads > 1)
+        ROOT::EnableThreadSafety();
+    // Scanned parameters fixed in each fit
+    auto config {fFitter.Config()};
+    for(auto p : pars)
+        config.ParSettings(p).Fix();
+    bool anyFree {};
+    for(const auto& par : config.ParamsSettings())
+        anyFree = anyFree || !par.IsFixed();
+    // One clone and fitter per thread, each one fitting a contiguous block of points
+    // Every point starts from the minimum, so the result does not depend on the number of threads
+    std::vector<Objective> objs {};
+    std::vector<std::unique_ptr<ROOT::Fit::Fitter>> fitters {};
+    for(unsigned int t = 0; t < nthreads; t++)
+        objs.push_back(fObj.CloneDetached());
+    for(unsigned int t = 0; t < nthreads; t++)
+    {
+        auto& fitter {fitters.emplace_back(std::make_unique<ROOT::Fit::Fitter>())};
+        fitter->Config() = config;
+        fitter->Config().MinimizerOptions().SetPrintLevel(0);
+        SetFCN(*fitter, objs[t]);
+    }
+    const auto& best {fResult.Parameters()};
+    ThreadPool pool {nthreads};
+    pool.Run(nthreads,
+             [&](std::size_t t)
+             {
+                 auto& fitter {*fitters[t]};
+                 for(std::size_t i = t * points.size() / nthreads; i < (t + 1) * points.size() / nthreads; i++)
+                 {
+                     auto values {best};
+                     for(std::size_t k = 0; k < pars.size(); k++)
+                         values[pars[k]] = points[i][k];
+                     // Nothing left to minimize: plain evaluation
+                     if(!anyFree)
+                     {
+                         ret[i] = objs[t](values.data());
+                         continue;
+                     }
+                     for(std::size_t p = 0; p < values.size(); p++)
+                         fitter.Config().ParSettings(p).SetValue(values[p]);
+                     ret[i] = fitter.FitFCN() ? fitter.Result().MinFcnValue() : std::nan("");
+                 }
+             });
+    return ret;
+}
+
+TGraph* Fitters::Runner::ProfileScan(unsigned int ipar, unsigned int npoints, double min, double max,
+                                     unsigned int nthreads)
+{
+    if(npoints < 2)
+        throw std::runtime_error("Runner::ProfileScan(): npoints must be >= 2");
+    std::tie(min, max) = ScanRange(ipar, min, max);
+    std::vector<DoubleVec> points {};
+    for(unsigned int i = 0; i < npoints; i++)
+        points.push_back({min + i * (max - min) / (npoints - 1)});
+    auto fcn {Profile({ipar}, points, nthreads)};
+    auto name {fObj.GetModel()->ParameterName(ipar)};
+    auto g {std::make_shared<TGraph>()};
+    g->SetName(("Profile_" + name).c_str());
+    g->SetTitle((";" + name + ";#Delta FCN").c_str());
+    // Failed fits are left out
+    for(unsigned int i = 0; i < npoints; i++)
+        if(std::isfinite(fcn[i]))
+            g->SetPoint(g->GetN(), points[i][0], fcn[i] - fResult.MinFcnValue());
+    fProfiles[name] = g;
+    return g.get();
+}
+
+TGraph2D* Fitters::Runner::ProfileScan2D(unsigned int ipar, unsigned int jpar, unsigned int npoints, double imin,
+                                         double imax, double jmin, double jmax, unsigned int nthreads)
+{
+    if(npoints < 2)
+        throw std::runtime_error("Runner::ProfileScan2D(): npoints must be >= 2");
+    if(ipar == jpar)
+        throw std::runtime_error("Runner::ProfileScan2D(): scanned parameters must be different");
+    std::tie(imin, imax) = ScanRange(ipar, imin, imax);
+    std::tie(jmin, jmax) = ScanRange(jpar, jmin, jmax);
+    std::vector<DoubleVec> points {};
+    for(unsigned int i = 0; i < npoints; i++)
+        for(unsigned int j = 0; j < npoints; j++)
+            points.push_back({imin + i * (imax - imin) / (npoints - 1), jmin + j * (jmax - jmin) / (npoints - 1)});
+    auto fcn {Profile({ipar, jpar}, points, nthreads)};
+    auto iname {fObj.GetModel()->ParameterName(ipar)};
+    auto jname {fObj.GetModel()->ParameterName(jpar)};
+    auto g {std::make_shared<TGraph2D>()};
+    g->SetName(("Profile_" + iname + "_" + jname).c_str());
+    g->SetTitle((";" + iname + ";" + jname + ";#Delta FCN").c_str());
+    for(std::size_t i = 0; i < points.size(); i++)
+        if(std::isfinite(fcn[i]))
+            g->SetPoint(g->GetN(), points[i][0], points[i][1], fcn[i] - fResult.MinFcnValue());
+    fProfiles2D[iname + "_" + jname] = g;
+    return g.get();
+}
+
+Fitters::Runner::DoubleVec Fitters::Runner::ConfigSignature() const
+{
+    // Settings a minimum depends on, except the initial values of free parameters. Data contents are only
+    // compared by their sum and gamma functions by index: reuse is only done if the caller asks for it
+    DoubleVec ret {};
+    for(const auto& par : fFitter.Config().ParamsSettings())
+    {
+        ret.push_back(par.IsFixed());
+        ret.push_back(par.IsFixed() ? par.Value() : 0);
+        ret.push_back(par.HasLowerLimit() ? par.LowerLimit() : -1e300);
+        ret.push_back(par.HasUpperLimit() ? par.UpperLimit() : 1e300);
+    }
+    ret.push_back(fUseGradient);
+    ret.push_back(fObj.GetUseLikelihood());
+    ret.push_back(fObj.GetUseIntegral());
+    ret.push_back(fObj.GetUseDivisions());
+    ret.push_back(fObj.GetUseBinAverage());
+    ret.push_back(fObj.GetNdiv());
+    // Minimizer
+    const auto& opts {fFitter.Config().MinimizerOptions()};
+    ret.push_back(std::hash<std::string> {}(opts.MinimizerType() + "/" + opts.MinimizerAlgorithm()));
+    ret.push_back(opts.Strategy());
+    ret.push_back(opts.Tolerance());
+    ret.push_back(opts.Precision());
+    ret.push_back(opts.MaxFunctionCalls());
+    ret.push_back(opts.MaxIterations());
+    ret.push_back(opts.ErrorDef());
+    // Data: binning and total contents (prefix sums, O(1))
+    const auto& data {*fObj.GetData()};
+    ret.push_back(data.GetSize());
+    ret.push_back(data.GetXLow());
+    ret.push_back(data.GetXUp());
+    ret.push_back(data.IntegralBins(0, data.GetSize() - 1));
+    // Model evaluation
+    const auto& model {*fObj.GetModel()};
+    ret.push_back(static_cast<int>(model.GetVoigtMode()));
+    ret.push_back(model.GetUseSpline());
+    ret.push_back(model.GetGammaFuncs().size());
+    for(const auto& [idx, _] : model.GetGammaFuncs())
+        ret.push_back(idx);
+    return ret;
+}
+
+Fitters::Runner::DoubleVec Fitters::Runner::WarmStart()
+{
+    auto& settings {fFitter.Config().ParamsSettings()};
+    DoubleVec steps {};
+    for(const auto& par : settings)
+        steps.push_back(par.StepSize());
+    for(std::size_t p = 0; p < settings.size() && p < fLastPars.size(); p++)
+    {
+        auto& par {settings[p]};
+        if(par.IsFixed())
+            continue;
+        double value {fLastPars[p]};
+        if(par.HasLowerLimit())
+            value = std::max(value, par.LowerLimit());
+        if(par.HasUpperLimit())
+            value = std::min(value, par.UpperLimit());
+        par.SetValue(value);
+        // Minuit builds its first (diagonal) Hessian estimate from the step sizes: use the last errors
+        // Parameters fixed in the last fit have no error and keep their step
+        if(p < fLastErrors.size() && fLastErrors[p] > 0)
+            par.SetStepSize(fLastErrors[p]);
+    }
+    return steps;
+}
+
+void Fitters::Runner::PrintMultiStart() const
+{
+    const auto& ms {fMultiStart};
+    *fOut << BOLDGREEN << "---- Fitters::Runner multi-start ----" << '\n';
+    *fOut << "-> NStarts  : " << ms.fMinima.size() << '\n';
+    *fOut << "-> NValid   : " << std::count(ms.fValid.begin(), ms.fValid.end(), true) << '\n';
+    if(ms.fBest >= 0)
+    {
+        *fOut << "-> Best     : start " << ms.fBest << " with FCN = " << ms.fMinima[ms.fBest] << '\n';
+        *fOut << "-> AtBest   : " << ms.fNAtBest << " within " << ms.fTolerance << '\n';
+        *fOut << "-> StdDev   : " << ms.fStdDev << '\n';
+    }
+    for(std::size_t s = 0; s < ms.fMinima.size(); s++)
+        *fOut << "   start " << s << " : FCN = " << ms.fMinima[s] << (ms.fValid[s] ? "" : " (invalid)") << '\n';
+    *fOut << "--------------------------------------" << RESET << '\n';
+}
+
 bool Fitters::Runner::CompareDoubles(double a, double b, double tol) const
 {
     const auto greatedMagnitude {std::max(std::abs(a), std::abs(b))};
@@ -113,7 +911,7 @@ bool Fitters::Runner::CompareDoubles(double a, double b, double tol) const
 
 void Fitters::Runner::ParametersAtLimit()
 {
-    auto res {fFitter.Result()};
+    const auto& res {fResult};
     for(int i = 0; i < res.Parameters().size(); i++)
     {
         double min {};
@@ -127,15 +925,13 @@ void Fitters::Runner::ParametersAtLimit()
             bool closeToMax {CompareDoubles(res.Parameter(i), max)};
             if(closeToMin)
             {
-                std::cout << "\033[1m\033[31m"
-                          << "Parameter " << name << " reached LOWER limit of " << res.Parameter(i) << "\033[0m"
-                          << '\n';
+                *fOut << "\033[1m\033[31m"
+                      << "Parameter " << name << " reached LOWER limit of " << res.Parameter(i) << "\033[0m" << '\n';
             }
             if(closeToMax)
             {
-                std::cout << "\033[1m\033[31m"
-                          << "Parameter " << name << " reached UPPER limit of " << res.Parameter(i) << "\033[0m"
-                          << '\n';
+                *fOut << "\033[1m\033[31m"
+                      << "Parameter " << name << " reached UPPER limit of " << res.Parameter(i) << "\033[0m" << '\n';
             }
         }
     }
@@ -151,9 +947,17 @@ void Fitters::Runner::Write(const std::string& file) const
         names.push_back(fObj.GetModel()->ParameterName(i));
     f->WriteObject(&names, "ParNames");
     // and now fit result
-    TFitResult res {fFitter.Result()};
+    TFitResult res {fResult};
     f->WriteObject(&res, "FitResult");
     // And finally fitting range
     std::pair<double, double> range {fObj.GetData()->GetXLow(), fObj.GetData()->GetXUp()};
     f->WriteObject(&range, "FitRange");
+    // Profile scans, if any
+    for(const auto& [name, g] : fProfiles)
+        f->WriteObject(g.get(), g->GetName());
+    for(const auto& [name, g] : fProfiles2D)
+        f->WriteObject(g.get(), g->GetName());
+    // Counters of evaluations, if enabled
+    if(auto stats {fObj.GetStats()})
+        f->WriteObject(stats.get(), "FitStats");
 }
@@ -0,0 +1,35 @@
+#include "FitStats.h"
+
+#include "PhysColors.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <iostream>
+
+void Fitters::FitStats::Reset()
+{
+    fNFCN = 0;
+    fNGradient = 0;
+    fNConvolutions = 0;
+    fTotalTime = 0;
+    fModelTime = 0;
+    fConvTime = 0;
+    std::fill(fComponentTime.begin(), fComponentTime.end(), 0.);
+}
+
+void Fitters::FitStats::Print(std::ostream& out) const
+{
+    out << BOLDGREEN << "---- Fitters::FitStats ----" << '\n';
+    out << "-> NFCN          : " << fNFCN << '\n';
+    out << "-> NGradient     : " << fNGradient << '\n';
+    out << "-> NConvolutions : " << fNConvolutions << '\n';
+    out << "-> Total time    : " << fTotalTime << " s" << '\n';
+    out << "-> Model time    : " << fModelTime << " s" << '\n';
+    out << "-> Conv. time    : " << fConvTime << " s" << '\n';
+    if(fNFCN + fNGradient > 0)
+        out << "-> Per call      : " << 1e6 * fTotalTime / (fNFCN + fNGradient) << " us" << '\n';
+    for(std::size_t i = 0; i < fComponents.size() && i < fComponentTime.size(); i++)
+        if(fComponentTime[i] > 0)
+            out << "   " << fComponents[i] << " : " << fComponentTime[i] << " s" << '\n';
+    out << "---------------------------" << RESET << '\n';
+}
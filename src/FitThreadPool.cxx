@@ -0,0 +1,96 @@
+#include "FitThreadPool.h"
+
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+
+Fitters::ThreadPool::ThreadPool(unsigned int nthreads)
+{
+    if(nthreads == 0)
+        throw std::runtime_error("ThreadPool::ThreadPool(): number of threads must be > 0");
+    // Caller of Run also works, so one less worker
+    for(unsigned int t = 1; t < nthreads; t++)
+        fWorkers.emplace_back(&ThreadPool::Work, this);
+}
+
+Fitters::ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock {fMutex};
+        fStop = true;
+    }
+    fWake.notify_all();
+    for(auto& worker : fWorkers)
+        worker.join();
+}
+
+void Fitters::ThreadPool::Run(std::size_t ntasks, const std::function<void(std::size_t)>& task)
+{
+    std::lock_guard<std::mutex> run {fRunMutex};
+    // Nothing to share
+    if(fWorkers.empty() || ntasks < 2)
+    {
+        for(std::size_t i = 0; i < ntasks; i++)
+            task(i);
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock {fMutex};
+        fTask = &task;
+        fNTasks = ntasks;
+        fNext = 0;
+        fPending = fWorkers.size();
+        fError = nullptr;
+        fGeneration++;
+    }
+    fWake.notify_all();
+    Drain();
+    // Wait for workers to leave the job before task goes out of scope
+    std::unique_lock<std::mutex> lock {fMutex};
+    fDone.wait(lock, [this] { return fPending == 0; });
+    fTask = nullptr;
+    if(fError)
+        std::rethrow_exception(fError);
+}
+
+void Fitters::ThreadPool::Work()
+{
+    unsigned long seen {};
+    while(true)
+    {
+        {
+            std::unique_lock<std::mutex> lock {fMutex};
+            fWake.wait(lock, [this, seen] { return fStop || fGeneration != seen; });
+            if(fStop)
+                return;
+            seen = fGeneration;
+        }
+        Drain();
+        {
+            std::lock_guard<std::mutex> lock {fMutex};
+            if(--fPending == 0)
+                fDone.notify_one();
+        }
+    }
+}
+
+void Fitters::ThreadPool::Drain()
+{
+    // Grab task indexes until none is left
+    for(std::size_t i = fNext++; i < fNTasks; i = fNext++)
+    {
+        try
+        {
+            (*fTask)(i);
+        }
+        catch(...)
+        {
+            std::lock_guard<std::mutex> lock {fMutex};
+            if(!fError)
+                fError = std::current_exception();
+        }
+    }
+}
@@ -0,0 +1,42 @@
+// Nominal counts of a bootstrap must be those of Angular::Fitter::DoCounts: the closed-form integral of each peak
+// over the fit range, in units of the bin width (not a sum of the peak at the bin centres)
+#include "FitData.h"
+#include "FitModel.h"
+#include "FitRunner.h"
+#include "FitVoigt.h"
+#include "TestUtils.h"
+
+#include <cmath>
+#include <vector>
+
+int main()
+{
+    // Coarse bins (width of the order of sigma) and peaks close to the edges of the range, where a sum at the
+    // centres and the integral differ
+    auto h {Tests::MakePeak("hCounts", 40, 0, 20, 200, 1.5, 0.8, 2)};
+    Fitters::Data data {h, 0, 20};
+    Fitters::Model model {1, 1, {}, true};
+    Fitters::Runner runner {data, model};
+    runner.SetInitial({{"g0", {180, 1.5, 0.8}}, {"v0", {1, 12, 1, 0.5}}, {"cte", {2}}});
+    runner.Fit(false);
+    runner.Bootstrap(4);
+    const auto& bs {runner.GetBootstrapStats()};
+    const auto& p {bs.fNominal};
+    double xmin {data.GetXLow()};
+    double xmax {data.GetXUp()};
+    double bw {data.GetBinWidth()};
+    // Same expressions as DoCounts
+    double ua {(xmin - p[1]) / (M_SQRT2 * p[2])};
+    double ub {(xmax - p[1]) / (M_SQRT2 * p[2])};
+    double gauss {p[0] * p[2] * std::sqrt(M_PI / 2) * (std::erf(ub) - std::erf(ua)) / bw};
+    double voigt {p[3] * Fitters::Voigt::Integral(xmin - p[4], xmax - p[4], p[5], p[6]) / bw};
+    auto close {[](double a, double b) { return std::abs(a - b) <= 1e-9 * std::max(1., std::abs(b)); }};
+    Tests::Check(bs.fNominalCounts.count("g0") && close(bs.fNominalCounts.at("g0"), gauss),
+                 "nominal bootstrap counts of g0 differ from DoCounts");
+    Tests::Check(bs.fNominalCounts.count("v0") && close(bs.fNominalCounts.at("v0"), voigt),
+                 "nominal bootstrap counts of v0 differ from DoCounts");
+    Tests::Check(!bs.fNominalCounts.count("cte"), "counts reported for the background");
+    for(const auto& [key, counts] : bs.fCounts)
+        Tests::Check(counts.size() == bs.fParams.size(), "counts missing for some replicas of " + key);
+    return Tests::Result();
+}
@@ -0,0 +1,26 @@
+// Runner::SetUseGradient(false) keeps the minimizer on its own numerical derivatives: the analytic gradient of the
+// objective must not be evaluated. With it enabled, it must be
+#include "FitData.h"
+#include "FitModel.h"
+#include "FitRunner.h"
+#include "TestUtils.h"
+
+int main()
+{
+    auto h {Tests::MakePeak("hGrad", 100, -5, 5, 100, 0, 1)};
+    Fitters::Data data {h, -5, 5};
+    Fitters::Model model {1, 0};
+    Fitters::Runner runner {data, model};
+    runner.SetInitial({{"g0", {80, 0.2, 1.2}}});
+    runner.SetUseStats(true);
+
+    runner.SetUseGradient(false);
+    runner.Fit(false);
+    Tests::Check(runner.GetStats()->fNGradient == 0, "gradient evaluated with SetUseGradient(false)");
+    Tests::Check(runner.GetStats()->fNFCN > 0, "no FCN calls with SetUseGradient(false)");
+
+    runner.SetUseGradient(true);
+    runner.Fit(false);
+    Tests::Check(runner.GetStats()->fNGradient > 0, "gradient not evaluated with SetUseGradient(true)");
+    return Tests::Result();
+}
@@ -0,0 +1,45 @@
+// Baker-Cousins likelihood with an empty bin and a negative model value there: the FCN must grow with |f| instead
+// of decreasing without bound, and its gradient must agree
+#include "FitData.h"
+#include "FitModel.h"
+#include "FitObjective.h"
+#include "TestUtils.h"
+
+#include <cmath>
+#include <vector>
+
+int main()
+{
+    // Flat data with one empty bin at x = 5
+    std::vector<double> x(10);
+    std::vector<double> y(10, 10);
+    for(unsigned int i = 0; i < x.size(); i++)
+        x[i] = i + 0.5;
+    y[5] = 0;
+    Fitters::Data data {x.data(), y.data(), x.size()};
+    // Narrow negative Gaussian on the empty bin over a constant: f < 0 only there
+    Fitters::Model model {1, 0, {}, true};
+    Fitters::Objective obj {data, model};
+    obj.SetUseLikelihood(true);
+    std::vector<double> atZero {-10, 5.5, 0.2, 10};
+    std::vector<double> below {-20, 5.5, 0.2, 10};
+    std::vector<double> further {-40, 5.5, 0.2, 10};
+    double fcnZero {obj(atZero.data())};
+    double fcnBelow {obj(below.data())};
+    double fcnFurther {obj(further.data())};
+    Tests::Check(std::isfinite(fcnBelow) && fcnBelow >= 0, "likelihood negative or not finite for f < 0");
+    Tests::Check(fcnBelow > fcnZero, "f < 0 in an empty bin is preferred to f = 0");
+    Tests::Check(fcnFurther > fcnBelow, "likelihood decreases as f goes further below 0");
+    // Gradient in the amplitude against central differences
+    std::vector<double> grad(obj.NDim());
+    obj.Gradient(below.data(), grad.data());
+    double h {1e-4};
+    auto up {below};
+    auto down {below};
+    up[0] += h;
+    down[0] -= h;
+    double numerical {(obj(up.data()) - obj(down.data())) / (2 * h)};
+    Tests::Check(std::abs(grad[0] - numerical) <= 1e-4 * std::max(1., std::abs(numerical)),
+                 "gradient of the likelihood does not match its finite differences for f < 0");
+    return Tests::Result();
+}
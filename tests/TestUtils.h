@@ -0,0 +1,49 @@
+#ifndef TestUtils_h
+#define TestUtils_h
+
+#include "TH1.h"
+
+#include <cmath>
+#include <iostream>
+#include <string>
+
+namespace Tests
+{
+// Number of failed checks of the test
+inline int& Failures()
+{
+    static int failures {};
+    return failures;
+}
+
+inline void Check(bool condition, const std::string& what)
+{
+    if(condition)
+        return;
+    std::cerr << "FAILED: " << what << '\n';
+    Failures()++;
+}
+
+inline int Result()
+{
+    if(Failures())
+        std::cerr << Failures() << " check(s) failed" << '\n';
+    return Failures() ? 1 : 0;
+}
+
+// Gaussian peak of amp counts per bin on a flat background (rounded, deterministic)
+inline TH1D MakePeak(const std::string& name, int nbins, double xmin, double xmax, double amp, double mean,
+                     double sigma, double bkg = 0)
+{
+    TH1D h {name.c_str(), "Test", nbins, xmin, xmax};
+    h.SetDirectory(nullptr);
+    for(int b = 1; b <= nbins; b++)
+    {
+        double arg {(h.GetBinCenter(b) - mean) / sigma};
+        h.SetBinContent(b, std::round(amp * std::exp(-0.5 * arg * arg) + bkg));
+    }
+    return h;
+}
+} // namespace Tests
+
+#endif // !TestUtils_h